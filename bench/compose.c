@@ -0,0 +1,169 @@
+#include "../mwd.h"
+
+/*
+	Measure how software composition scales with the number of worker threads.
+
+	Each frame is a desktop the size of the output, like the headless backend
+	would give: a tiled set of opaque windows, a translucent panel and a few
+	translucent popups, and one window with a buffer twice the size of its box
+	as a HiDPI client would have. The frame is composed with 1, 2, 4 and 8
+	threads, and every thread count must give the same pixels.
+
+	Usage:
+		make bench
+*/
+
+#define BENCH_TARGET_NSEC		(500 * 1000 * 1000)
+#define BENCH_LAYERS_MAX		16
+
+static uint64_t BenchNow(void)
+{
+	struct timespec		now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Fill a buffer with a pattern, premultiplied if it has an alpha */
+static uint32_t *BenchPixels(int width, int height, uint8_t alpha, uint32_t seed)
+{
+	uint32_t			*pixels;
+	uint32_t			r, g, b;
+
+	if (!(pixels = malloc((size_t) width * height * sizeof(uint32_t)))) {
+		exit(1);
+	}
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			r = ((x + seed) * 7) & 0xff;
+			g = ((y + seed) * 5) & 0xff;
+			b = ((x ^ y) + seed) & 0xff;
+
+			pixels[(size_t) y * width + x] = ((uint32_t) alpha << 24) |
+				((r * alpha / 255) << 16) | ((g * alpha / 255) << 8) | (b * alpha / 255);
+		}
+	}
+	return pixels;
+}
+
+static void BenchLayer(mwdComposeLayer *layer, int width, int height, int x, int y, int boxWidth, int boxHeight,
+		uint8_t alpha, uint32_t seed)
+{
+	layer->pixels	= BenchPixels(width, height, alpha, seed);
+	layer->stride	= width * sizeof(uint32_t);
+	layer->width	= width;
+	layer->height	= height;
+	layer->box.x	= x;
+	layer->box.y	= y;
+	layer->box.width	= boxWidth;
+	layer->box.height	= boxHeight;
+	layer->opaque	= alpha == 255;
+}
+
+static int BenchScene(mwdComposeLayer *layers, int width, int height)
+{
+	int					count	= 0;
+	int					panel	= height / 30;
+	int					w		= width / 3;
+	int					h		= (height - panel) / 2;
+
+	/* Six tiled windows, the last with a buffer at twice the scale */
+	for (int i = 0; i < 6; i++) {
+		int				x = (i % 3) * w;
+		int				y = panel + (i / 3) * h;
+
+		if (i == 5) {
+			BenchLayer(&layers[count++], w * 2, h * 2, x, y, w, h, 255, i);
+		} else {
+			BenchLayer(&layers[count++], w, h, x, y, w, h, 255, i);
+		}
+	}
+
+	BenchLayer(&layers[count++], width, panel, 0, 0, width, panel, 200, 10);
+
+	/* Translucent popups across the tiles */
+	BenchLayer(&layers[count++], width / 4, height / 3, width / 8, height / 4, width / 4, height / 3, 160, 20);
+	BenchLayer(&layers[count++], width / 5, height / 4, width / 2, height / 2, width / 5, height / 4, 128, 21);
+	BenchLayer(&layers[count++], 300, 200, width - 320, height - 220, 300, 200, 230, 22);
+
+	return count;
+}
+
+static uint64_t BenchChecksum(const uint32_t *pixels, size_t count)
+{
+	uint64_t			sum = 1469598103934665603ull;
+
+	for (size_t i = 0; i < count; i++) {
+		sum = (sum ^ pixels[i]) * 1099511628211ull;
+	}
+	return sum;
+}
+
+static void BenchRun(int width, int height)
+{
+	mwdComposeLayer		layers[BENCH_LAYERS_MAX];
+	mwdComposePool		pool;
+	int					threads[]	= { 1, 2, 4, 8 };
+	int					count		= BenchScene(layers, width, height);
+	uint32_t			*dst;
+	uint64_t			first		= 0;
+	uint64_t			sum;
+	uint64_t			start, elapsed;
+	uint32_t			frames;
+	double				base		= 0;
+	double				nsec;
+
+	if (!(dst = malloc((size_t) width * height * sizeof(uint32_t)))) {
+		exit(1);
+	}
+
+	for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+		if (!ComposePoolStart(&pool, threads[t])) {
+			exit(1);
+		}
+
+		/* Warm up, and check that the result doesn't depend on the thread count */
+		ComposeFrame(&pool, dst, width, height, width * sizeof(uint32_t), 0xff4c4c4c, layers, count);
+		sum = BenchChecksum(dst, (size_t) width * height);
+
+		if (t == 0) {
+			first = sum;
+		} else if (sum != first) {
+			printf("%dx%d: %d threads gave different pixels\n", width, height, threads[t]);
+			exit(1);
+		}
+
+		frames	= 0;
+		start	= BenchNow();
+		do {
+			ComposeFrame(&pool, dst, width, height, width * sizeof(uint32_t), 0xff4c4c4c, layers, count);
+			frames++;
+			elapsed = BenchNow() - start;
+		} while (elapsed < BENCH_TARGET_NSEC);
+
+		nsec = (double) elapsed / frames;
+		if (t == 0) {
+			base = nsec;
+		}
+
+		printf("%4dx%-4d %d layers: %d threads %8.2fms/frame  (%.2fx)\n",
+				width, height, count, threads[t], nsec / 1000000, base / nsec);
+
+		ComposePoolStop(&pool);
+	}
+
+	for (int i = 0; i < count; i++) {
+		free((void *) layers[i].pixels);
+	}
+	free(dst);
+}
+
+int main(int argc, char *argv[])
+{
+	printf("%ld cpus\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+	BenchRun(1920, 1080);
+	BenchRun(3840, 2160);
+	return 0;
+}
@@ -0,0 +1,299 @@
+#include "../mwd.h"
+
+/*
+	Compare the cost of the traversals done by rendering, hit-testing and
+	focus lookups over individually allocated views (the old layout) against
+	views in the store.
+
+	Rendering and hit-testing walk the visible draw order list in both cases,
+	since only the drawn views are in it. The old layout reads each view, and
+	the store only reads the view's entry in the contiguous hot array unless
+	that says the view may be at the point. Finding a surface has to look at
+	every view, hidden or not; a list walk before, and a scan of the hot array
+	in the store.
+
+	Between each individually allocated view a few other allocations are made,
+	as the shells and clients would, so that the views are spread across the
+	heap the way they would be in a running compositor.
+
+	The render walks only collect the drawn views; sorting them by layer is
+	left out, since it is the same for both.
+
+	One view in 32 is unbounded, as if it had a popup open, so the store's
+	lookup by position has to ask those views even though none of them is at
+	the point. The old list walk asked every view anyway.
+
+	Usage:
+		make bench
+*/
+
+#define BENCH_TARGET_NSEC		(200 * 1000 * 1000)
+#define BENCH_SIZE				2000.0
+
+static uint64_t BenchNow(void)
+{
+	struct timespec		now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void BenchSetView(mwdView *view, uint32_t i, struct wlr_surface *surface)
+{
+	double				x = (double) (rand() % (int) BENCH_SIZE);
+	double				y = (double) (rand() % (int) BENCH_SIZE);
+
+	view->geometry.pos.left		= x;
+	view->geometry.pos.top		= y;
+	view->geometry.pos.right	= x + 200;
+	view->geometry.pos.bottom	= y + 150;
+	view->geometry.render		= view->geometry.pos;
+	view->geometry.valid		= true;
+
+	/* Roughly one view in four is on a selected tag */
+	view->mapped	= true;
+	view->drawn		= (i % 4) == 0;
+	view->seq.draw	= i + 1;
+	view->tags		= 1 << (i % MWD_TAG_COUNT);
+	view->xdg.surface	= (struct wlr_xdg_surface *) surface;
+}
+
+/* Stands in for the shell's is.at, which only accepts points on the view */
+static bool BenchViewAt(mwdView *view, double x, double y)
+{
+	return x >= view->geometry.render.left && x < view->geometry.render.right &&
+		y >= view->geometry.render.top && y < view->geometry.render.bottom;
+}
+
+/* The old layout; walk the visible list from the top, reading the view itself */
+static mwdView *BenchListAt(struct wl_list *visible, double x, double y)
+{
+	mwdView				*view;
+
+	wl_list_for_each(view, visible, link.visible.drawOrder) {
+		if (BenchViewAt(view, x, y)) {
+			return view;
+		}
+	}
+	return NULL;
+}
+
+static mwdView *BenchListSurface(struct wl_list *list, struct wlr_surface *surface)
+{
+	mwdView				*view;
+
+	wl_list_for_each(view, list, link.drawOrder) {
+		if (view->mapped && (struct wlr_surface *) view->xdg.surface == surface) {
+			return view;
+		}
+	}
+	return NULL;
+}
+
+static uint32_t BenchListRender(struct wl_list *visible)
+{
+	mwdView				*view;
+	uint32_t			count = 0;
+
+	for (int layer = MWD_LAYER_BEFORE + 1; layer < MWD_LAYER_AFTER; layer++) {
+		wl_list_for_each_reverse(view, visible, link.visible.drawOrder) {
+			if (view->renderLayer == (mwdLayer) layer) {
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+/* The store; ViewFindByPos's loop, with BenchViewAt in place of the shell's is.at */
+static mwdView *BenchStoreAt(struct wl_list *visible, double x, double y)
+{
+	mwdView				*view;
+	mwdViewHot			*hot;
+
+	wl_list_for_each(view, visible, link.visible.drawOrder) {
+		hot = StoreHot(view);
+
+		if (!hot->unbounded && (
+			x < hot->bounds.left || x >= hot->bounds.right ||
+			y < hot->bounds.top || y >= hot->bounds.bottom)
+		) {
+			continue;
+		}
+
+		if (BenchViewAt(view, x, y)) {
+			return view;
+		}
+	}
+	return NULL;
+}
+
+static mwdView *BenchStoreSurface(mwdStore *store, struct wlr_surface *surface)
+{
+	for (uint32_t i = 0; i < store->used; i++) {
+		if (store->hot[i].surface == surface) {
+			return store->hot[i].view;
+		}
+	}
+	return NULL;
+}
+
+static uint32_t BenchStoreRender(mwdStore *store, struct wl_list *visible)
+{
+	mwdView				*view;
+	mwdViewHot			*hot;
+	uint32_t			count = 0;
+
+	wl_list_for_each_reverse(view, visible, link.visible.drawOrder) {
+		hot = StoreHot(view);
+
+		if (hot->unbounded || (hot->outputs & 1)) {
+			store->order[count++] = hot;
+		}
+	}
+	return count;
+}
+
+typedef struct BenchResult
+{
+	double				at, surface, render;
+} BenchResult;
+
+/* Run each traversal enough times to take about BENCH_TARGET_NSEC */
+#define BENCH_RUN(result, expr)										\
+	do {															\
+		uint64_t	start, elapsed;									\
+		uint32_t	iterations = 1;									\
+																	\
+		for (;;) {													\
+			start = BenchNow();										\
+			for (uint32_t n = 0; n < iterations; n++) {				\
+				sink += (uintptr_t) (expr);							\
+			}														\
+			elapsed = BenchNow() - start;							\
+																	\
+			if (elapsed >= BENCH_TARGET_NSEC) {						\
+				break;												\
+			}														\
+			iterations *= 2;										\
+		}															\
+		(result) = (double) elapsed / iterations;					\
+	} while (0)
+
+static volatile uintptr_t		sink;
+
+static void BenchRun(uint32_t count)
+{
+	mwdServer			server;
+	mwdStore			*store		= &server.views.store;
+	struct wl_list		list, listVisible, storeVisible;
+	mwdView				*view, *tmp;
+	mwdViewHot			*hot;
+	void				**junk;
+	struct wlr_surface	**surfaces;
+	struct wlr_surface	*wanted;
+	BenchResult			before, after;
+	double				x, y;
+
+	memset(&server, 0, sizeof(server));
+	StoreMain(&server);
+	wl_list_init(&list);
+	wl_list_init(&listVisible);
+	wl_list_init(&storeVisible);
+
+	if (!(junk = calloc(count * 4, sizeof(void *))) ||
+		!(surfaces = calloc(count, sizeof(struct wlr_surface *)))
+	) {
+		exit(1);
+	}
+
+	/* The surfaces are only compared, never dereferenced */
+	for (uint32_t i = 0; i < count; i++) {
+		surfaces[i] = (struct wlr_surface *) (uintptr_t) (0x1000 + i * 16);
+	}
+
+	srand(count);
+	for (uint32_t i = 0; i < count; i++) {
+		if (!(view = calloc(1, sizeof(mwdView)))) {
+			exit(1);
+		}
+
+		BenchSetView(view, i, surfaces[i]);
+		wl_list_insert(&list, &view->link.drawOrder);
+		if (view->drawn) {
+			wl_list_insert(&listVisible, &view->link.visible.drawOrder);
+		}
+
+		for (int j = 0; j < 4; j++) {
+			junk[i * 4 + j] = malloc(64 + rand() % 512);
+		}
+	}
+
+	srand(count);
+	for (uint32_t i = 0; i < count; i++) {
+		if (!(view = StoreAlloc(&server))) {
+			exit(1);
+		}
+		view->server = &server;
+		BenchSetView(view, i, surfaces[i]);
+		if (view->drawn) {
+			wl_list_insert(&storeVisible, &view->link.visible.drawOrder);
+		}
+
+		hot				= StoreHot(view);
+		hot->surface	= surfaces[i];
+		hot->bounds		= view->geometry.render;
+		hot->outputs	= 1;
+		hot->seq		= view->seq.draw;
+		hot->layer		= view->renderLayer;
+
+		/* Some views have popups open, so they have to be asked every time */
+		hot->unbounded	= (i % 32) == 0;
+	}
+
+	/*
+		Look for a surface in the middle of both, and for a point that no view
+		covers so that both have to look at every view.
+	*/
+	wanted	= surfaces[count / 2];
+	x		= BENCH_SIZE + 500;
+	y		= BENCH_SIZE + 500;
+
+	BENCH_RUN(before.at,		BenchListAt(&listVisible, x, y));
+	BENCH_RUN(before.surface,	BenchListSurface(&list, wanted));
+	BENCH_RUN(before.render,	BenchListRender(&listVisible));
+
+	BENCH_RUN(after.at,			BenchStoreAt(&storeVisible, x, y));
+	BENCH_RUN(after.surface,	BenchStoreSurface(store, wanted));
+	BENCH_RUN(after.render,		BenchStoreRender(store, &storeVisible));
+
+	printf("%6u views: %-14s list %10.0fns  store %10.0fns  (%.1fx)\n",
+			count, "find by pos", before.at, after.at, before.at / after.at);
+	printf("%6u views: %-14s list %10.0fns  store %10.0fns  (%.1fx)\n",
+			count, "find surface", before.surface, after.surface, before.surface / after.surface);
+	printf("%6u views: %-14s list %10.0fns  store %10.0fns  (%.1fx)\n",
+			count, "render walk", before.render, after.render, before.render / after.render);
+
+	wl_list_for_each_safe(view, tmp, &list, link.drawOrder) {
+		wl_list_remove(&view->link.drawOrder);
+		free(view);
+	}
+	for (uint32_t i = 0; i < count * 4; i++) {
+		free(junk[i]);
+	}
+	free(junk);
+	free(surfaces);
+	StoreFinish(&server);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t			counts[] = { 100, 1000, 10000 };
+
+	printf("sizeof(mwdView) %zu, sizeof(mwdViewHot) %zu\n", sizeof(mwdView), sizeof(mwdViewHot));
+
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		BenchRun(counts[i]);
+	}
+	return 0;
+}
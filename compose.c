@@ -0,0 +1,434 @@
+#include "../mwd.h"
+
+/*
+	Tile parallel software composition
+
+	Without a GPU all of the composition happens on the CPU, and doing it on
+	the main thread means input and clients wait on it every frame. Instead
+	the frame is split into tiles, and a pool of worker threads composite the
+	tiles. Every worker takes the next tile that nobody has taken yet until
+	there are none left, so a tile with more layers on it doesn't hold up the
+	others.
+
+	The main thread only hands the list of layers (the pixels of each surface
+	and the box to draw them in) to the pool and waits for the result. The
+	layers are read only while the frame is being composed, and the main
+	thread doesn't run while it waits, so nothing that they point at can
+	change underneath the workers.
+
+	The pixels are ARGB8888, premultiplied, which is what wl_shm clients use,
+	or XRGB8888 which is copied without blending. The alpha of the result is
+	undefined, since the frame is opaque. Layers are scaled to their box with
+	nearest neighbour sampling.
+*/
+
+#define COMPOSE_TILE_WIDTH		256
+#define COMPOSE_TILE_HEIGHT		64
+
+/* Blend a premultiplied source pixel over a destination pixel */
+static inline uint32_t ComposeOver(uint32_t src, uint32_t dst)
+{
+	uint32_t		alpha	= src >> 24;
+	uint32_t		inv		= 255 - alpha;
+	uint32_t		rb, ag;
+
+	if (alpha == 255) {
+		return src;
+	}
+	if (alpha == 0) {
+		return dst;
+	}
+
+	/* Two channels at a time, with the usual divide by 255 approximation */
+	rb = (dst & 0x00ff00ff) * inv + 0x00800080;
+	rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+
+	ag = ((dst >> 8) & 0x00ff00ff) * inv + 0x00800080;
+	ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+
+	return src + (rb | ag);
+}
+
+/* Composite one layer into the part of a tile that it covers */
+static void ComposeLayer(mwdComposePool *pool, const mwdComposeLayer *layer,
+		int tx1, int ty1, int tx2, int ty2)
+{
+	int				x1	= layer->box.x > tx1 ? layer->box.x : tx1;
+	int				y1	= layer->box.y > ty1 ? layer->box.y : ty1;
+	int				x2	= layer->box.x + layer->box.width;
+	int				y2	= layer->box.y + layer->box.height;
+	uint32_t		stepX, stepY;
+	uint32_t		*dst;
+	const uint32_t	*src;
+	uint32_t		u, v;
+
+	x2 = x2 < tx2 ? x2 : tx2;
+	y2 = y2 < ty2 ? y2 : ty2;
+
+	if (x1 >= x2 || y1 >= y2) {
+		return;
+	}
+
+	/* 16.16 fixed point steps through the source for each destination pixel */
+	stepX	= ((uint64_t) layer->width << 16) / layer->box.width;
+	stepY	= ((uint64_t) layer->height << 16) / layer->box.height;
+
+	for (int y = y1; y < y2; y++) {
+		v	= (uint32_t) (y - layer->box.y) * stepY;
+		src	= (const uint32_t *) ((const uint8_t *) layer->pixels + (size_t) (v >> 16) * layer->stride);
+		dst	= (uint32_t *) ((uint8_t *) pool->frame.dst + (size_t) y * pool->frame.stride);
+		u	= (uint32_t) (x1 - layer->box.x) * stepX;
+
+		if (layer->opaque && stepX == 0x10000) {
+			memcpy(dst + x1, src + (u >> 16), (x2 - x1) * sizeof(uint32_t));
+			continue;
+		}
+
+		if (layer->opaque) {
+			for (int x = x1; x < x2; x++, u += stepX) {
+				dst[x] = src[u >> 16];
+			}
+		} else {
+			for (int x = x1; x < x2; x++, u += stepX) {
+				dst[x] = ComposeOver(src[u >> 16], dst[x]);
+			}
+		}
+	}
+}
+
+static void ComposeTile(mwdComposePool *pool, int tile)
+{
+	int				tx1	= (tile % pool->frame.tilesX) * COMPOSE_TILE_WIDTH;
+	int				ty1	= (tile / pool->frame.tilesX) * COMPOSE_TILE_HEIGHT;
+	int				tx2	= tx1 + COMPOSE_TILE_WIDTH;
+	int				ty2	= ty1 + COMPOSE_TILE_HEIGHT;
+	int				first	= 0;
+	const mwdComposeLayer	*layer;
+	uint32_t		*dst;
+
+	tx2 = tx2 < pool->frame.width ? tx2 : pool->frame.width;
+	ty2 = ty2 < pool->frame.height ? ty2 : pool->frame.height;
+
+	/* Anything below an opaque layer that covers the whole tile is hidden */
+	for (int i = pool->frame.count - 1; i >= 0; i--) {
+		layer = &pool->frame.layers[i];
+
+		if (layer->opaque &&
+			layer->box.x <= tx1 && layer->box.x + layer->box.width >= tx2 &&
+			layer->box.y <= ty1 && layer->box.y + layer->box.height >= ty2
+		) {
+			first = i;
+			break;
+		}
+	}
+
+	if (first == 0) {
+		for (int y = ty1; y < ty2; y++) {
+			dst = (uint32_t *) ((uint8_t *) pool->frame.dst + (size_t) y * pool->frame.stride);
+
+			for (int x = tx1; x < tx2; x++) {
+				dst[x] = pool->frame.background;
+			}
+		}
+	}
+
+	for (int i = first; i < pool->frame.count; i++) {
+		ComposeLayer(pool, &pool->frame.layers[i], tx1, ty1, tx2, ty2);
+	}
+}
+
+static void *ComposeWorker(void *data)
+{
+	mwdComposePool	*pool		= data;
+	uint64_t		generation	= 0;
+	int				tile;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		while (!pool->stopping && pool->generation == generation) {
+			pthread_cond_wait(&pool->start, &pool->lock);
+		}
+
+		if (pool->stopping) {
+			break;
+		}
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		while ((tile = atomic_fetch_add(&pool->frame.next, 1)) < pool->frame.tiles) {
+			ComposeTile(pool, tile);
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		if (!--pool->busy) {
+			pthread_cond_signal(&pool->done);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/*
+	Composite the layers, bottom first, into dst which is width by height
+	pixels. Returns once the whole frame is done.
+*/
+void ComposeFrame(mwdComposePool *pool, uint32_t *dst, int width, int height, int stride,
+		uint32_t background, const mwdComposeLayer *layers, int count)
+{
+	pool->frame.dst			= dst;
+	pool->frame.width		= width;
+	pool->frame.height		= height;
+	pool->frame.stride		= stride;
+	pool->frame.background	= background;
+	pool->frame.layers		= layers;
+	pool->frame.count		= count;
+	pool->frame.tilesX		= (width + COMPOSE_TILE_WIDTH - 1) / COMPOSE_TILE_WIDTH;
+	pool->frame.tiles		= pool->frame.tilesX * ((height + COMPOSE_TILE_HEIGHT - 1) / COMPOSE_TILE_HEIGHT);
+	atomic_store(&pool->frame.next, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->busy = pool->count;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+
+	while (pool->busy) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+bool ComposePoolStart(mwdComposePool *pool, int threads)
+{
+	memset(pool, 0, sizeof(mwdComposePool));
+
+	if (threads < 1 || !(pool->threads = calloc(threads, sizeof(pthread_t)))) {
+		return false;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (pool->count = 0; pool->count < threads; pool->count++) {
+		if (pthread_create(&pool->threads[pool->count], NULL, ComposeWorker, pool)) {
+			wlr_log(WLR_ERROR, "Failed to start composition thread %d", pool->count);
+			ComposePoolStop(pool);
+			return false;
+		}
+	}
+	return true;
+}
+
+void ComposePoolStop(mwdComposePool *pool)
+{
+	if (!pool->threads) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->count; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+
+	free(pool->threads);
+	memset(pool, 0, sizeof(mwdComposePool));
+}
+
+static void ComposeSurfaceDestroy(struct wl_listener *listener, void *data)
+{
+	mwdComposeSurface	*cs = wl_container_of(listener, cs, destroy);
+
+	wl_list_remove(&cs->commit.link);
+	wl_list_remove(&cs->destroy.link);
+	free(cs->pixels);
+	free(cs);
+}
+
+/* Copy the part of a shm buffer inside a box, row by row */
+static void ComposeSurfaceCopy(mwdComposeSurface *cs, const uint8_t *data, int stride,
+		int x1, int y1, int x2, int y2)
+{
+	x1 = x1 > 0 ? x1 : 0;
+	y1 = y1 > 0 ? y1 : 0;
+	x2 = x2 < cs->width ? x2 : cs->width;
+	y2 = y2 < cs->height ? y2 : cs->height;
+
+	for (int y = y1; y < y2; y++) {
+		memcpy(cs->pixels + (size_t) y * cs->width + x1,
+				data + (size_t) y * stride + (size_t) x1 * sizeof(uint32_t),
+				(x2 - x1) * sizeof(uint32_t));
+	}
+}
+
+/*
+	Keep a copy of every shm buffer as it is committed. The client may reuse
+	its buffer as soon as it has been uploaded, and the workers can't call
+	into wl_shm, so the copy is what gets composed. Only the damaged part of
+	the buffer is copied, unless its size changed.
+*/
+static void ComposeSurfaceCommit(struct wl_listener *listener, void *data)
+{
+	mwdComposeSurface	*cs			= wl_container_of(listener, cs, commit);
+	struct wlr_surface	*surface	= cs->surface;
+	struct wl_shm_buffer	*shm	= NULL;
+	uint32_t			format;
+	int					width, height, stride;
+	const uint8_t		*pixels;
+	pixman_box32_t		*rects;
+	int					count;
+	bool				full;
+
+	if (surface->buffer && surface->buffer->resource) {
+		shm = wl_shm_buffer_get(surface->buffer->resource);
+	}
+
+	if (!shm) {
+		/*
+			A buffer without a resource is the shm buffer the copy was made
+			from, which was released once it was uploaded, so the copy is
+			still current. Otherwise the surface was unmapped, or it has a
+			buffer that isn't shm (ie dmabuf), and the old pixels must not be
+			composed in its place; without them the layer is rejected.
+		*/
+		if (!surface->buffer || surface->buffer->resource) {
+			free(cs->pixels);
+			cs->pixels = NULL;
+		}
+		return;
+	}
+
+	format = wl_shm_buffer_get_format(shm);
+	if (format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888) {
+		free(cs->pixels);
+		cs->pixels = NULL;
+		return;
+	}
+
+	width	= wl_shm_buffer_get_width(shm);
+	height	= wl_shm_buffer_get_height(shm);
+	stride	= wl_shm_buffer_get_stride(shm);
+	full	= !cs->pixels || width != cs->width || height != cs->height;
+
+	if (full) {
+		free(cs->pixels);
+		if (!(cs->pixels = malloc((size_t) width * height * sizeof(uint32_t)))) {
+			wlr_log(WLR_ERROR, "Failed to allocate a %dx%d surface copy", width, height);
+			return;
+		}
+		cs->width	= width;
+		cs->height	= height;
+	}
+	cs->opaque = format == WL_SHM_FORMAT_XRGB8888;
+
+	wl_shm_buffer_begin_access(shm);
+	pixels = wl_shm_buffer_get_data(shm);
+
+	if (full) {
+		ComposeSurfaceCopy(cs, pixels, stride, 0, 0, width, height);
+	} else {
+		rects = pixman_region32_rectangles(&surface->buffer_damage, &count);
+
+		for (int i = 0; i < count; i++) {
+			ComposeSurfaceCopy(cs, pixels, stride, rects[i].x1, rects[i].y1, rects[i].x2, rects[i].y2);
+		}
+	}
+
+	wl_shm_buffer_end_access(shm);
+}
+
+static void ComposeNewSurface(struct wl_listener *listener, void *data)
+{
+	struct wlr_surface	*surface = data;
+	mwdComposeSurface	*cs;
+
+	if (!(cs = calloc(1, sizeof(mwdComposeSurface)))) {
+		wlr_log(WLR_ERROR, "Failed to allocate a surface copy");
+		return;
+	}
+	cs->surface = surface;
+
+	cs->commit.notify = ComposeSurfaceCommit;
+	wl_signal_add(&surface->events.commit, &cs->commit);
+
+	cs->destroy.notify = ComposeSurfaceDestroy;
+	wl_signal_add(&surface->events.destroy, &cs->destroy);
+}
+
+/*
+	Fill in a layer for drawing a surface in a box. Returns false if the
+	surface can't be composed in software, ie because it has a buffer that
+	isn't shm, or a transform.
+*/
+bool ComposeSurfaceLayer(struct wlr_surface *surface, struct wlr_box *box, mwdComposeLayer *layer)
+{
+	struct wl_listener	*listener;
+	mwdComposeSurface	*cs;
+
+	if (!(listener = wl_signal_get(&surface->events.destroy, ComposeSurfaceDestroy))) {
+		return false;
+	}
+	cs = wl_container_of(listener, cs, destroy);
+
+	if (!cs->pixels || surface->current.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+		box->width <= 0 || box->height <= 0
+	) {
+		return false;
+	}
+
+	layer->pixels	= cs->pixels;
+	layer->stride	= cs->width * sizeof(uint32_t);
+	layer->width	= cs->width;
+	layer->height	= cs->height;
+	layer->box		= *box;
+	layer->opaque	= cs->opaque;
+	layer->surface	= surface;
+	return true;
+}
+
+bool ComposeSetThreads(mwdServer *server, const char *threads)
+{
+	char				*end;
+	long				value = strtol(threads, &end, 10);
+
+	if (end == threads || *end || value < 0 || value > 64) {
+		wlr_log(WLR_ERROR, "Invalid number of composition threads: %s", threads);
+		return false;
+	}
+
+	server->compose.threads = value;
+	return true;
+}
+
+/* Start the workers. This must be called after the compositor is created. */
+void ComposeMain(mwdServer *server)
+{
+	if (!server->compose.threads) {
+		return;
+	}
+
+	if (!ComposePoolStart(&server->compose.pool, server->compose.threads)) {
+		wlr_log(WLR_ERROR, "Failed to start software composition, using the renderer");
+		server->compose.threads = 0;
+		return;
+	}
+
+	server->compose.newSurface.notify = ComposeNewSurface;
+	wl_signal_add(&server->compositor->events.new_surface, &server->compose.newSurface);
+
+	wlr_log(WLR_INFO, "Composing in software with %d threads", server->compose.threads);
+}
+
+void ComposeStop(mwdServer *server)
+{
+	ComposePoolStop(&server->compose.pool);
+}
@@ -0,0 +1,204 @@
+#include "../mwd.h"
+#include <wlr/types/wlr_relative_pointer_v1.h>
+#include <wlr/types/wlr_pointer_constraints_v1.h>
+#include <wlr/util/region.h>
+
+/*
+	Relative pointer and pointer constraints
+
+	These allow clients (mostly games) to receive raw, unaccelerated motion and
+	to lock or confine the pointer to a surface.
+
+	Only the constraint for the surface with keyboard focus is ever active.
+*/
+
+static void ConstraintDeactivate(mwdServer *server)
+{
+	mwdPointerConstraint				*active = server->constraints.active;
+	struct wlr_pointer_constraint_v1	*constraint;
+	mwdView								*view;
+	double								top, left;
+
+	if (!active) {
+		return;
+	}
+	constraint = active->constraint;
+	server->constraints.active = NULL;
+
+	/*
+		The client may have provided a hint about where the cursor should be
+		when a locked pointer is released.
+	*/
+	if (constraint->type == WLR_POINTER_CONSTRAINT_V1_LOCKED &&
+		(constraint->current.committed & WLR_POINTER_CONSTRAINT_V1_STATE_CURSOR_HINT) &&
+		(view = ViewFindBySurface(server, constraint->surface))
+	) {
+		ViewGetRenderPos(view, &top, NULL, NULL, &left);
+
+		wlr_cursor_warp(server->cursor, NULL,
+				left + constraint->current.cursor_hint.x,
+				top + constraint->current.cursor_hint.y);
+	}
+
+	wlr_pointer_constraint_v1_send_deactivated(constraint);
+}
+
+/*
+	A confined pointer that is outside of the region when the constraint is
+	activated would never be able to get into it, so move it to the middle of
+	the first rectangle in the region.
+*/
+static void ConstraintConfine(mwdServer *server, struct wlr_pointer_constraint_v1 *constraint)
+{
+	mwdView					*view;
+	pixman_box32_t			*boxes;
+	int						count;
+	double					top, left;
+	double					sx, sy;
+
+	if (constraint->type != WLR_POINTER_CONSTRAINT_V1_CONFINED ||
+		!(view = ViewFindBySurface(server, constraint->surface))
+	) {
+		return;
+	}
+
+	/* The region is clipped to the surface, so it is never negative */
+	ViewGetRenderPos(view, &top, NULL, NULL, &left);
+	sx = server->cursor->x - left;
+	sy = server->cursor->y - top;
+
+	if (sx >= 0 && sy >= 0 && pixman_region32_contains_point(&constraint->region, (int) sx, (int) sy, NULL)) {
+		return;
+	}
+
+	boxes = pixman_region32_rectangles(&constraint->region, &count);
+	if (count > 0) {
+		wlr_cursor_warp_closest(server->cursor, NULL,
+				left + (boxes[0].x1 + boxes[0].x2) / 2.0,
+				top  + (boxes[0].y1 + boxes[0].y2) / 2.0);
+	}
+}
+
+static void ConstraintActivate(mwdServer *server, mwdPointerConstraint *c)
+{
+	if (server->constraints.active == c) {
+		return;
+	}
+
+	ConstraintDeactivate(server);
+
+	if (c) {
+		server->constraints.active = c;
+		ConstraintConfine(server, c->constraint);
+		wlr_pointer_constraint_v1_send_activated(c->constraint);
+	}
+}
+
+/* Activate the constraint (if any) for a surface that has received focus */
+void ConstraintFocus(mwdServer *server, struct wlr_surface *surface)
+{
+	struct wlr_pointer_constraint_v1	*constraint = NULL;
+
+	if (surface) {
+		constraint = wlr_pointer_constraints_v1_constraint_for_surface(server->constraints.mgr, surface, server->seat);
+	}
+
+	ConstraintActivate(server, constraint ? constraint->data : NULL);
+}
+
+bool ConstraintIsLocked(mwdServer *server)
+{
+	mwdPointerConstraint	*active = server->constraints.active;
+
+	return active && active->constraint->type == WLR_POINTER_CONSTRAINT_V1_LOCKED;
+}
+
+/*
+	Send relative motion to the focused client and apply the active constraint
+	to the delta.
+
+	Returns false if the pointer is locked and should not be moved at all.
+*/
+bool ConstraintMotion(mwdServer *server, uint32_t time, double *dx, double *dy, double unaccelX, double unaccelY)
+{
+	mwdPointerConstraint				*active	= server->constraints.active;
+	struct wlr_pointer_constraint_v1	*constraint;
+	mwdView								*view;
+	double								top, left;
+	double								sx, sy;
+	double								tx, ty;
+
+	wlr_relative_pointer_manager_v1_send_relative_motion(server->constraints.relativeMgr, server->seat,
+			(uint64_t) time * 1000, *dx, *dy, unaccelX, unaccelY);
+
+	if (!active) {
+		return true;
+	}
+	constraint = active->constraint;
+
+	if (constraint->type == WLR_POINTER_CONSTRAINT_V1_LOCKED) {
+		return false;
+	}
+
+	if (!(view = ViewFindBySurface(server, constraint->surface))) {
+		return true;
+	}
+
+	/* The region is in surface local coordinates */
+	ViewGetRenderPos(view, &top, NULL, NULL, &left);
+	sx = server->cursor->x - left;
+	sy = server->cursor->y - top;
+
+	if (wlr_region_confine(&constraint->region, sx, sy, sx + *dx, sy + *dy, &tx, &ty)) {
+		*dx = tx - sx;
+		*dy = ty - sy;
+	}
+	return true;
+}
+
+static void ConstraintDestroy(struct wl_listener *listener, void *data)
+{
+	mwdPointerConstraint	*c			= wl_container_of(listener, c, destroy);
+	mwdServer				*server		= c->server;
+
+	if (server->constraints.active == c) {
+		/* The constraint is already gone, so nothing should be sent to it */
+		server->constraints.active = NULL;
+	}
+
+	wl_list_remove(&c->destroy.link);
+	free(c);
+}
+
+static void ConstraintNew(struct wl_listener *listener, void *data)
+{
+	mwdServer							*server		= wl_container_of(listener, server, constraints.newConstraint);
+	struct wlr_pointer_constraint_v1	*constraint	= data;
+	mwdPointerConstraint				*c;
+
+	if (!(c = calloc(1, sizeof(mwdPointerConstraint)))) {
+		return;
+	}
+
+	c->server			= server;
+	c->constraint		= constraint;
+	constraint->data	= c;
+
+	c->destroy.notify = ConstraintDestroy;
+	wl_signal_add(&constraint->events.destroy, &c->destroy);
+
+	if (constraint->surface == server->seat->keyboard_state.focused_surface) {
+		ConstraintActivate(server, c);
+	}
+}
+
+void ConstraintMain(mwdServer *server)
+{
+	server->constraints.relativeMgr	= wlr_relative_pointer_manager_v1_create(server->display);
+	server->constraints.mgr			= wlr_pointer_constraints_v1_create(server->display);
+	server->constraints.active		= NULL;
+
+	server->constraints.newConstraint.notify = ConstraintNew;
+	wl_signal_add(&server->constraints.mgr->events.new_constraint, &server->constraints.newConstraint);
+}
+
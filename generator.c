@@ -0,0 +1,553 @@
+#include "../mwd.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/*
+	External layout generator
+
+	When started with -l <command> the command is run with a socket connected
+	to its stdin and stdout, and is asked to generate the tiling layouts. Each
+	request is a single line:
+
+		layout <serial> <count> <width> <height> <kind> <master count> <master ratio> <columns>
+
+	where kind is "tile" or "columns", and the generator must reply with a
+	single line that starts with the same serial, followed by the geometry of
+	every view, relative to the top left of the usable area:
+
+		<serial> <x> <y> <width> <height> <x> <y> <width> <height> ...
+
+	The views are in the same order that the built-in layouts use, with the
+	newest view first.
+
+	Replies are cached by the request parameters, so a layout is only
+	requested the first time a given number of views is arranged in a given
+	area with given parameters. mwd never waits for the generator; a layout
+	that isn't cached is requested, and the views are left as they are until
+	the reply arrives. If the reply does not arrive within the timeout then
+	the built-in layout is used for those parameters until it does.
+*/
+
+#define GENERATOR_TIMEOUT_MS		100
+#define GENERATOR_CACHE_MAX			64
+#define GENERATOR_REQUESTS_MAX		64
+#define GENERATOR_REAP_MS			500
+#define GENERATOR_REAP_TRIES		4
+
+static bool GeneratorKeyEqual(mwdGeneratorKey *a, mwdGeneratorKey *b)
+{
+	return a->count			== b->count			&&
+		a->width			== b->width			&&
+		a->height			== b->height		&&
+		a->kind				== b->kind			&&
+		a->masterCount		== b->masterCount	&&
+		a->masterRatio		== b->masterRatio	&&
+		a->columns			== b->columns;
+}
+
+static void GeneratorCacheFree(mwdGeneratorEntry *entry)
+{
+	wl_list_remove(&entry->link);
+	free(entry->boxes);
+	free(entry);
+}
+
+static mwdGeneratorEntry *GeneratorCacheFind(mwdServer *server, mwdGeneratorKey *key)
+{
+	mwdGeneratorEntry		*entry;
+
+	wl_list_for_each(entry, &server->generator.cache, link) {
+		if (GeneratorKeyEqual(&entry->key, key)) {
+			/* Keep the most recently used entries at the front */
+			wl_list_remove(&entry->link);
+			wl_list_insert(&server->generator.cache, &entry->link);
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/*
+	Add (or replace) a cache entry. The boxes are owned by the entry. If boxes
+	is NULL then the entry means the built-in layout should be used.
+*/
+static void GeneratorCacheAdd(mwdServer *server, mwdGeneratorKey *key, mwdTileBox *boxes)
+{
+	mwdGeneratorEntry		*entry;
+
+	if ((entry = GeneratorCacheFind(server, key))) {
+		free(entry->boxes);
+		entry->boxes = boxes;
+		return;
+	}
+
+	if (server->generator.cacheCount >= GENERATOR_CACHE_MAX) {
+		/* Drop the least recently used entry */
+		entry = wl_container_of(server->generator.cache.prev, entry, link);
+		GeneratorCacheFree(entry);
+		server->generator.cacheCount--;
+	}
+
+	if (!(entry = calloc(1, sizeof(mwdGeneratorEntry)))) {
+		free(boxes);
+		return;
+	}
+	entry->key		= *key;
+	entry->boxes	= boxes;
+
+	wl_list_insert(&server->generator.cache, &entry->link);
+	server->generator.cacheCount++;
+}
+
+static void GeneratorRequestFree(mwdGeneratorRequest *request)
+{
+	request->server->generator.requestCount--;
+
+	wl_list_remove(&request->link);
+	if (request->timer) {
+		wl_event_source_remove(request->timer);
+	}
+	free(request);
+}
+
+static int GeneratorTimeout(void *data)
+{
+	mwdGeneratorRequest		*request	= data;
+	mwdServer				*server		= request->server;
+
+	wlr_log(WLR_DEBUG, "Layout generator did not reply to %u in time; using the built-in layout", request->serial);
+	server->generator.timeouts++;
+
+	/*
+		Keep the request so a late reply can still be used, but fall back to
+		the built-in layout until then.
+	*/
+	wl_event_source_remove(request->timer);
+	request->timer		= NULL;
+	request->timedOut	= true;
+
+	GeneratorCacheAdd(server, &request->key, NULL);
+	TileMarkAllDirty(server);
+	return 0;
+}
+
+/* Write as much of the output buffer as the socket will take */
+static void GeneratorFlush(mwdServer *server)
+{
+	ssize_t			len;
+
+	while (server->generator.outLen > 0) {
+		/* A generator that exited must not take mwd down with SIGPIPE */
+		len = send(server->generator.fd, server->generator.out, server->generator.outLen, MSG_NOSIGNAL);
+
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN) {
+				wlr_log_errno(WLR_ERROR, "Failed to write to the layout generator");
+				GeneratorStop(server);
+				return;
+			}
+			break;
+		}
+
+		memmove(server->generator.out, server->generator.out + len, server->generator.outLen - len);
+		server->generator.outLen -= len;
+	}
+
+	/* Wait for the socket to be writable if anything is left */
+	wl_event_source_fd_update(server->generator.source,
+			WL_EVENT_READABLE | (server->generator.outLen ? WL_EVENT_WRITABLE : 0));
+}
+
+static bool GeneratorSend(mwdServer *server, mwdGeneratorRequest *request)
+{
+	char			line[256];
+	int				len;
+	char			*out;
+
+	len = snprintf(line, sizeof(line), "layout %u %d %d %d %s %d %f %d\n",
+			request->serial, request->key.count,
+			request->key.width, request->key.height,
+			request->key.kind == MWD_TILE_COLUMNS ? "columns" : "tile",
+			request->key.masterCount, request->key.masterRatio, request->key.columns);
+
+	if (server->generator.outLen + len > server->generator.outSize) {
+		if (!(out = realloc(server->generator.out, server->generator.outLen + len))) {
+			return false;
+		}
+		server->generator.out		= out;
+		server->generator.outSize	= server->generator.outLen + len;
+	}
+
+	memcpy(server->generator.out + server->generator.outLen, line, len);
+	server->generator.outLen += len;
+
+	GeneratorFlush(server);
+	return true;
+}
+
+static void GeneratorReply(mwdServer *server, char *line)
+{
+	mwdGeneratorRequest		*request;
+	mwdTileBox				*boxes;
+	uint32_t				serial;
+	double					v[4];
+	char					*p;
+	int						i, n;
+
+	serial = strtoul(line, &p, 10);
+	if (p == line) {
+		wlr_log(WLR_ERROR, "Invalid reply from the layout generator: %s", line);
+		return;
+	}
+
+	wl_list_for_each(request, &server->generator.requests, link) {
+		if (request->serial == serial) {
+			break;
+		}
+	}
+	if (&request->link == &server->generator.requests) {
+		/* Probably a request that was dropped */
+		return;
+	}
+
+	if (!(boxes = calloc(request->key.count, sizeof(mwdTileBox)))) {
+		GeneratorRequestFree(request);
+		return;
+	}
+
+	for (i = 0; i < request->key.count; i++) {
+		for (n = 0; n < 4; n++) {
+			line	= p;
+			v[n]	= strtod(line, &p);
+
+			if (p == line) {
+				break;
+			}
+		}
+
+		if (n < 4) {
+			break;
+		}
+
+		boxes[i].left		= v[0];
+		boxes[i].top		= v[1];
+		boxes[i].right		= v[0] + v[2];
+		boxes[i].bottom		= v[1] + v[3];
+	}
+
+	if (i < request->key.count) {
+		wlr_log(WLR_ERROR, "The layout generator replied to %u with too few views; using the built-in layout", serial);
+
+		free(boxes);
+		boxes = NULL;
+	}
+
+	GeneratorCacheAdd(server, &request->key, boxes);
+	GeneratorRequestFree(request);
+
+	/* Any output may be waiting on these parameters */
+	TileMarkAllDirty(server);
+}
+
+static int GeneratorReadable(int fd, uint32_t mask, void *data)
+{
+	mwdServer		*server	= data;
+	ssize_t			len;
+	char			*line, *end;
+
+	if (mask & WL_EVENT_WRITABLE) {
+		GeneratorFlush(server);
+
+		if (server->generator.fd < 0) {
+			return 0;
+		}
+	}
+
+	if (!(mask & WL_EVENT_READABLE) && (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR))) {
+		wlr_log(WLR_ERROR, "The layout generator has exited");
+		GeneratorStop(server);
+		return 0;
+	}
+
+	if (!(mask & WL_EVENT_READABLE)) {
+		return 0;
+	}
+
+	len = read(fd, server->generator.in + server->generator.inLen,
+			sizeof(server->generator.in) - server->generator.inLen - 1);
+
+	if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+		wlr_log(WLR_ERROR, "The layout generator has exited");
+		GeneratorStop(server);
+		return 0;
+	}
+	if (len < 0) {
+		return 0;
+	}
+
+	server->generator.inLen += len;
+	server->generator.in[server->generator.inLen] = '\0';
+
+	/* Handle each complete line */
+	line = server->generator.in;
+	while ((end = strchr(line, '\n'))) {
+		*end = '\0';
+		GeneratorReply(server, line);
+		line = end + 1;
+	}
+
+	server->generator.inLen -= line - server->generator.in;
+	memmove(server->generator.in, line, server->generator.inLen);
+
+	if (server->generator.inLen == sizeof(server->generator.in) - 1) {
+		wlr_log(WLR_ERROR, "Reply from the layout generator is too long; discarding");
+		server->generator.inLen = 0;
+	}
+	return 0;
+}
+
+/*
+	Fill out the boxes for count views in the area, relative to the top left of
+	the area, using the external generator.
+
+	Returns MWD_GENERATOR_BUILTIN if the built-in layout should be used,
+	MWD_GENERATOR_DONE if the boxes were filled out, or MWD_GENERATOR_WAITING
+	if the layout has been requested and the views should be left as they are.
+*/
+mwdGeneratorResult GeneratorLayout(mwdOutput *output, mwdTileBox *area, int count, mwdTileBox *boxes)
+{
+	mwdServer				*server = output->server;
+	mwdGeneratorKey			key;
+	mwdGeneratorEntry		*entry;
+	mwdGeneratorRequest		*request;
+	struct wl_event_loop	*loop;
+
+	if (server->generator.fd < 0) {
+		return MWD_GENERATOR_BUILTIN;
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.count		= count;
+	key.width		= area->right - area->left;
+	key.height		= area->bottom - area->top;
+	key.kind		= output->tile.kind;
+	key.masterCount	= output->tile.masterCount;
+	key.masterRatio	= output->tile.masterRatio;
+	key.columns		= output->tile.columns;
+
+	if ((entry = GeneratorCacheFind(server, &key))) {
+		server->generator.hits++;
+
+		if (!entry->boxes) {
+			return MWD_GENERATOR_BUILTIN;
+		}
+
+		for (int i = 0; i < count; i++) {
+			boxes[i].top		= area->top		+ entry->boxes[i].top;
+			boxes[i].right		= area->left	+ entry->boxes[i].right;
+			boxes[i].bottom		= area->top		+ entry->boxes[i].bottom;
+			boxes[i].left		= area->left	+ entry->boxes[i].left;
+		}
+		return MWD_GENERATOR_DONE;
+	}
+
+	/* Don't ask again if these parameters have already been requested */
+	wl_list_for_each(request, &server->generator.requests, link) {
+		if (!request->timedOut && GeneratorKeyEqual(&request->key, &key)) {
+			return MWD_GENERATOR_WAITING;
+		}
+	}
+	server->generator.misses++;
+
+	if (server->generator.requestCount >= GENERATOR_REQUESTS_MAX) {
+		/* Drop the oldest request; it will never be answered now */
+		request = wl_container_of(server->generator.requests.prev, request, link);
+		GeneratorRequestFree(request);
+	}
+
+	if (!(request = calloc(1, sizeof(mwdGeneratorRequest)))) {
+		return MWD_GENERATOR_BUILTIN;
+	}
+	request->server	= server;
+	request->serial	= ++server->generator.serial;
+	request->key	= key;
+
+	loop = wl_display_get_event_loop(server->display);
+	if (!(request->timer = wl_event_loop_add_timer(loop, GeneratorTimeout, request))) {
+		free(request);
+		return MWD_GENERATOR_BUILTIN;
+	}
+	wl_event_source_timer_update(request->timer, GENERATOR_TIMEOUT_MS);
+
+	wl_list_insert(&server->generator.requests, &request->link);
+	server->generator.requestCount++;
+
+	/*
+		If the request couldn't be queued it will time out like any other, but
+		if the write failed the generator has been stopped.
+	*/
+	GeneratorSend(server, request);
+	return server->generator.fd < 0 ? MWD_GENERATOR_BUILTIN : MWD_GENERATOR_WAITING;
+}
+
+/*
+	Reap a generator that was told to stop, so it doesn't stay behind as a
+	zombie. It gets a little time to exit after SIGTERM, and is then killed.
+*/
+static int GeneratorReap(void *data)
+{
+	mwdServer		*server	= data;
+	pid_t			pid		= server->generator.reapPid;
+
+	if (!pid) {
+		return 0;
+	}
+
+	if (waitpid(pid, NULL, WNOHANG) != 0) {
+		/* It exited, or it isn't our child any more */
+		server->generator.reapPid = 0;
+		return 0;
+	}
+
+	if (++server->generator.reapTries >= GENERATOR_REAP_TRIES) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		server->generator.reapPid = 0;
+		return 0;
+	}
+
+	wl_event_source_timer_update(server->generator.reapTimer, GENERATOR_REAP_MS);
+	return 0;
+}
+
+static void GeneratorTerminate(mwdServer *server, pid_t pid)
+{
+	struct wl_event_loop	*loop = wl_display_get_event_loop(server->display);
+
+	/* Only one is reaped at a time; finish off the previous one first */
+	if (server->generator.reapPid) {
+		server->generator.reapTries = GENERATOR_REAP_TRIES;
+		GeneratorReap(server);
+	}
+
+	kill(pid, SIGTERM);
+	server->generator.reapPid	= pid;
+	server->generator.reapTries	= 0;
+
+	if (!server->generator.reapTimer) {
+		server->generator.reapTimer = wl_event_loop_add_timer(loop, GeneratorReap, server);
+	}
+
+	if (waitpid(pid, NULL, WNOHANG) != 0) {
+		server->generator.reapPid = 0;
+	} else if (server->generator.reapTimer) {
+		wl_event_source_timer_update(server->generator.reapTimer, GENERATOR_REAP_MS);
+	}
+}
+
+/* Run the command, with a socket connected to its stdin and stdout */
+bool GeneratorStart(mwdServer *server, const char *command)
+{
+	struct wl_event_loop	*loop = wl_display_get_event_loop(server->display);
+	int						fds[2];
+	pid_t					pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to create a socket for the layout generator");
+		return false;
+	}
+
+	if ((pid = fork()) < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to start the layout generator");
+		goto failure;
+	}
+
+	if (pid == 0) {
+		/* Child */
+		dup2(fds[1], STDIN_FILENO);
+		dup2(fds[1], STDOUT_FILENO);
+
+		execl("/bin/sh", "/bin/sh", "-c", command, (void *)NULL);
+		_exit(1);
+	}
+	close(fds[1]);
+	fds[1] = -1;
+
+	if (fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK) < 0) {
+		goto failure;
+	}
+
+	if (!(server->generator.source = wl_event_loop_add_fd(loop, fds[0], WL_EVENT_READABLE, GeneratorReadable, server))) {
+		goto failure;
+	}
+
+	server->generator.pid	= pid;
+	server->generator.fd	= fds[0];
+
+	/* Anything that was arranged before the generator started is stale */
+	TileMarkAllDirty(server);
+	return true;
+
+failure:
+	if (pid > 0) {
+		GeneratorTerminate(server, pid);
+	}
+	close(fds[0]);
+	if (fds[1] >= 0) {
+		close(fds[1]);
+	}
+	return false;
+}
+
+/* Stop the generator, and go back to the built-in layouts */
+void GeneratorStop(mwdServer *server)
+{
+	mwdGeneratorRequest		*request, *tmp;
+	mwdGeneratorEntry		*entry, *etmp;
+
+	if (server->generator.source) {
+		wl_event_source_remove(server->generator.source);
+		server->generator.source = NULL;
+	}
+
+	if (server->generator.fd >= 0) {
+		close(server->generator.fd);
+		server->generator.fd = -1;
+	}
+
+	if (server->generator.pid > 0) {
+		GeneratorTerminate(server, server->generator.pid);
+		server->generator.pid = 0;
+	}
+
+	wl_list_for_each_safe(request, tmp, &server->generator.requests, link) {
+		GeneratorRequestFree(request);
+	}
+
+	wl_list_for_each_safe(entry, etmp, &server->generator.cache, link) {
+		GeneratorCacheFree(entry);
+	}
+	server->generator.cacheCount = 0;
+
+	free(server->generator.out);
+	server->generator.out		= NULL;
+	server->generator.outLen	= 0;
+	server->generator.outSize	= 0;
+	server->generator.inLen		= 0;
+
+	TileMarkAllDirty(server);
+}
+
+void GeneratorMain(mwdServer *server)
+{
+	server->generator.fd = -1;
+
+	wl_list_init(&server->generator.requests);
+	wl_list_init(&server->generator.cache);
+}
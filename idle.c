@@ -0,0 +1,295 @@
+#include "../mwd.h"
+
+/*
+	Idle tracking
+
+	Every input event is reported to the idle protocol, so that clients such
+	as swayidle can lock the screen or power off the outputs, unless a visible
+	surface has an idle inhibitor (ie a video player).
+
+	After a period with no input the outputs are also downclocked. Each output
+	is switched to the mode with the lowest refresh rate at its current size,
+	or if it has no such mode (ie a nested or headless output) its frames are
+	throttled instead. The first input event after that restores them.
+
+	Input events only record the time, so that the timer doesn't have to be
+	reset on every event. When the timer fires it is armed again for the time
+	that is left, if there was input in the meantime.
+*/
+
+#define IDLE_THROTTLE_MSEC		100
+
+static uint64_t IdleNow(void)
+{
+	struct timespec		now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Returns true if any surface with an inhibitor is visible */
+static bool IdleInhibited(mwdServer *server)
+{
+	mwdIdleInhibitor	*inhibitor;
+	mwdView				*view;
+
+	wl_list_for_each(inhibitor, &server->idle.inhibitors, link) {
+		view = ViewFindBySurface(server, wlr_surface_get_root_surface(inhibitor->inhibitor->surface));
+
+		if (view && view->visible) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+	Check if idle should be inhibited, and tell wlr_idle if that changed. This
+	is called whenever an inhibitor is added or removed, and whenever a view is
+	shown or hidden, since that changes if its inhibitor counts.
+*/
+void IdleUpdateInhibit(mwdServer *server)
+{
+	bool				inhibited;
+
+	if (!server->idle.idle) {
+		return;
+	}
+
+	if ((inhibited = IdleInhibited(server)) != server->idle.inhibited) {
+		server->idle.inhibited = inhibited;
+		wlr_idle_set_enabled(server->idle.idle, NULL, !inhibited);
+	}
+}
+
+/* Find the mode with the lowest refresh rate at the current size */
+static struct wlr_output_mode *IdleLowestMode(struct wlr_output *output)
+{
+	struct wlr_output_mode	*mode;
+	struct wlr_output_mode	*lowest = output->current_mode;
+
+	if (!lowest) {
+		return NULL;
+	}
+
+	wl_list_for_each(mode, &output->modes, link) {
+		if (mode->width == lowest->width && mode->height == lowest->height && mode->refresh < lowest->refresh) {
+			lowest = mode;
+		}
+	}
+	return lowest;
+}
+
+static void IdleDownclock(mwdServer *server)
+{
+	mwdOutput				*output;
+	struct wlr_output_mode	*mode;
+	struct wlr_output_mode	*current;
+
+	wl_list_for_each(output, &server->outputs, link) {
+		if (!output->powered) {
+			continue;
+		}
+
+		current	= output->output->current_mode;
+		mode	= IdleLowestMode(output->output);
+
+		if (mode && mode != current) {
+			wlr_output_set_mode(output->output, mode);
+
+			if (wlr_output_test(output->output) && wlr_output_commit(output->output)) {
+				output->idle.mode = current;
+				continue;
+			}
+			wlr_output_rollback(output->output);
+		}
+
+		/* There is no slower mode, so draw less often instead */
+		output->idle.throttled = true;
+	}
+
+	server->idle.downclocked = true;
+}
+
+static void IdleRestore(mwdServer *server)
+{
+	mwdOutput				*output;
+
+	wl_list_for_each(output, &server->outputs, link) {
+		if (output->idle.mode) {
+			wlr_output_set_mode(output->output, output->idle.mode);
+
+			if (!wlr_output_commit(output->output)) {
+				wlr_log(WLR_ERROR, "Failed to restore the refresh rate of output %s", output->output->name);
+			}
+			output->idle.mode = NULL;
+		}
+
+		if (output->idle.throttled) {
+			output->idle.throttled = false;
+			wlr_output_schedule_frame(output->output);
+		}
+	}
+
+	server->idle.downclocked = false;
+
+	if (server->profiles.deferred) {
+		ProfileOutputsChanged(server);
+	}
+}
+
+static int IdleTimer(void *data)
+{
+	mwdServer			*server		= data;
+	uint64_t			timeout		= (uint64_t) server->idle.downclockSecs * 1000;
+	uint64_t			elapsed		= IdleNow() - server->idle.last;
+
+	if (elapsed < timeout) {
+		/* There was input since the timer was armed */
+		wl_event_source_timer_update(server->idle.timer, timeout - elapsed);
+		return 0;
+	}
+
+	if (server->idle.inhibited) {
+		wl_event_source_timer_update(server->idle.timer, timeout);
+		return 0;
+	}
+
+	IdleDownclock(server);
+	return 0;
+}
+
+/* Called for every input event */
+void IdleActivity(mwdServer *server)
+{
+	server->idle.last = IdleNow();
+
+	if (server->idle.idle) {
+		wlr_idle_notify_activity(server->idle.idle, server->seat);
+	}
+
+	if (server->idle.downclocked) {
+		IdleRestore(server);
+		wl_event_source_timer_update(server->idle.timer, server->idle.downclockSecs * 1000);
+	}
+}
+
+/*
+	Returns true if a frame for the output should be skipped because it is
+	throttled. Another frame is scheduled for when one is due.
+*/
+bool IdleThrottleFrame(mwdOutput *output)
+{
+	uint64_t			now		= IdleNow();
+
+	if (!output->idle.throttled) {
+		return false;
+	}
+
+	if (now - output->idle.last >= IDLE_THROTTLE_MSEC) {
+		output->idle.last = now;
+		return false;
+	}
+
+	if (output->idle.timer) {
+		wl_event_source_timer_update(output->idle.timer, IDLE_THROTTLE_MSEC - (now - output->idle.last));
+	}
+	return true;
+}
+
+static int IdleFrameTimer(void *data)
+{
+	mwdOutput			*output = data;
+
+	wlr_output_schedule_frame(output->output);
+	return 0;
+}
+
+void IdleOutputInit(mwdOutput *output)
+{
+	struct wl_event_loop	*loop = wl_display_get_event_loop(output->server->display);
+
+	output->idle.mode		= NULL;
+	output->idle.throttled	= output->server->idle.downclocked;
+	output->idle.last		= 0;
+	output->idle.timer		= wl_event_loop_add_timer(loop, IdleFrameTimer, output);
+}
+
+void IdleOutputDestroy(mwdOutput *output)
+{
+	if (output->idle.timer) {
+		wl_event_source_remove(output->idle.timer);
+		output->idle.timer = NULL;
+	}
+}
+
+static void IdleInhibitorDestroy(struct wl_listener *listener, void *data)
+{
+	mwdIdleInhibitor	*inhibitor	= wl_container_of(listener, inhibitor, destroy);
+	mwdServer			*server		= inhibitor->server;
+
+	wl_list_remove(&inhibitor->link);
+	wl_list_remove(&inhibitor->destroy.link);
+	free(inhibitor);
+
+	IdleUpdateInhibit(server);
+}
+
+static void IdleNewInhibitor(struct wl_listener *listener, void *data)
+{
+	mwdServer						*server			= wl_container_of(listener, server, idle.newInhibitor);
+	struct wlr_idle_inhibitor_v1	*wlrInhibitor	= data;
+	mwdIdleInhibitor				*inhibitor;
+
+	if (!(inhibitor = calloc(1, sizeof(mwdIdleInhibitor)))) {
+		wlr_log(WLR_ERROR, "Failed to allocate an idle inhibitor");
+		return;
+	}
+	inhibitor->server		= server;
+	inhibitor->inhibitor	= wlrInhibitor;
+
+	inhibitor->destroy.notify = IdleInhibitorDestroy;
+	wl_signal_add(&wlrInhibitor->events.destroy, &inhibitor->destroy);
+
+	wl_list_insert(&server->idle.inhibitors, &inhibitor->link);
+	IdleUpdateInhibit(server);
+}
+
+bool IdleSetDownclock(mwdServer *server, const char *secs)
+{
+	char				*end;
+	long				value = strtol(secs, &end, 10);
+
+	if (end == secs || *end || value < 0) {
+		wlr_log(WLR_ERROR, "Invalid idle downclock time: %s", secs);
+		return false;
+	}
+
+	server->idle.downclockSecs = value;
+	return true;
+}
+
+void IdleMain(mwdServer *server)
+{
+	struct wl_event_loop	*loop = wl_display_get_event_loop(server->display);
+
+	wl_list_init(&server->idle.inhibitors);
+	server->idle.last			= IdleNow();
+	server->idle.downclocked	= false;
+	server->idle.inhibited		= false;
+
+	server->idle.idle		= wlr_idle_create(server->display);
+	server->idle.inhibit	= wlr_idle_inhibit_v1_create(server->display);
+
+	if (server->idle.inhibit) {
+		server->idle.newInhibitor.notify = IdleNewInhibitor;
+		wl_signal_add(&server->idle.inhibit->events.new_inhibitor, &server->idle.newInhibitor);
+	}
+
+	/* A downclock time of 0 turns downclocking off */
+	if (server->idle.downclockSecs &&
+		(server->idle.timer = wl_event_loop_add_timer(loop, IdleTimer, server))
+	) {
+		wl_event_source_timer_update(server->idle.timer, server->idle.downclockSecs * 1000);
+	}
+}
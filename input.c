@@ -16,10 +16,48 @@ static void handleCursorMove(mwdServer *server, uint32_t time)
 	*/
 	double			x		= server->cursor->x - server->grab.cursor.x;
 	double			y		= server->cursor->y - server->grab.cursor.y;
+	mwdOutput		*output	= OutputAt(server, server->cursor->x, server->cursor->y);
+
+	if (!ViewGrabMotion(server)) {
+		return;
+	}
+
+	/*
+		Don't let the top of the view be dragged under a panel, or it may not
+		be possible to grab it again.
+	*/
+	if (output && server->grab.top + y < output->usableArea.top) {
+		y = output->usableArea.top - server->grab.top;
+	}
 
 	ViewSetPos(view, server->grab.top + y, server->grab.right + x, server->grab.bottom + y, server->grab.left + x);
 }
 
+/* Keep the edges being dragged within the usable area of the cursor's output */
+static void constrainViewToUsableArea(mwdServer *server, uint32_t edges, double *top, double *right, double *bottom, double *left)
+{
+	mwdOutput		*output	= OutputAt(server, server->cursor->x, server->cursor->y);
+	mwdTileBox		*area;
+
+	if (!output) {
+		return;
+	}
+	area = &output->usableArea;
+
+	if ((edges & WLR_EDGE_TOP) && *top < area->top) {
+		*top = area->top;
+	}
+	if ((edges & WLR_EDGE_BOTTOM) && *bottom > area->bottom) {
+		*bottom = area->bottom;
+	}
+	if ((edges & WLR_EDGE_LEFT) && *left < area->left) {
+		*left = area->left;
+	}
+	if ((edges & WLR_EDGE_RIGHT) && *right > area->right) {
+		*right = area->right;
+	}
+}
+
 static void constrainViewSize(mwdView *view, uint32_t edges, double *top, double *right, double *bottom, double *left)
 {
 	double	width	= *right - *left;
@@ -58,7 +96,7 @@ static void constrainViewSize(mwdView *view, uint32_t edges, double *top, double
 		if (edges & WLR_EDGE_TOP) {
 			*top = *bottom - maxHeight;
 		} else if (edges & WLR_EDGE_BOTTOM) {
-			*bottom = *top + minHeight;
+			*bottom = *top + maxHeight;
 		}
 	}
 }
@@ -77,6 +115,10 @@ static void handleCursorResize(mwdServer *server, uint32_t time)
 	/* The edges of the box */
 	double	top, right, bottom, left;
 
+	if (!ViewGrabMotion(server)) {
+		return;
+	}
+
 	/* Set the values as they were when the resize was started */
 	top		= server->grab.top;
 	right	= server->grab.right;
@@ -96,6 +138,7 @@ static void handleCursorResize(mwdServer *server, uint32_t time)
 	}
 
 	/* Apply sanity checks */
+	constrainViewToUsableArea(server, server->grab.edges, &top, &right, &bottom, &left);
 	constrainViewSize(view, server->grab.edges, &top, &right, &bottom, &left);
 
 	/*
@@ -111,7 +154,7 @@ static void handleCursorResize(mwdServer *server, uint32_t time)
 		and position it properly based on those values and the specified edge.
 	*/
 	ViewSetPos(view, top, right, bottom, left);
-	view->edges = (~server->grab.edges) & (WLR_EDGE_TOP | WLR_EDGE_RIGHT | WLR_EDGE_BOTTOM | WLR_EDGE_LEFT);
+	ViewSetEdges(view, (~server->grab.edges) & (WLR_EDGE_TOP | WLR_EDGE_RIGHT | WLR_EDGE_BOTTOM | WLR_EDGE_LEFT));
 }
 
 static void handleCursorPassthrough(mwdServer *server, uint32_t time)
@@ -130,6 +173,7 @@ static void handleCursorPassthrough(mwdServer *server, uint32_t time)
 		wlr_seat_pointer_clear_focus(seat);
 	} else if (seat->pointer_state.focused_surface != surface) {
 		wlr_seat_pointer_notify_enter(seat, surface, sx, sy);
+		LatencyInput(view, time);
 
 		// TODO Give the user the choice to do sloppy focus or not. For now it
 		//		is hardcoded by calling this, and we do NOT raise the window
@@ -137,6 +181,7 @@ static void handleCursorPassthrough(mwdServer *server, uint32_t time)
 		ViewFocus(view, false);
 	} else {
 		wlr_seat_pointer_notify_motion(seat, time, sx, sy);
+		LatencyInput(view, time);
 	}
 }
 
@@ -163,8 +208,22 @@ static void cursorMotionRelative(struct wl_listener *listener, void *data)
 {
 	mwdServer							*server	= wl_container_of(listener, server, cursorMotionRelative);
 	struct wlr_event_pointer_motion		*event	= data;
+	double								dx		= event->delta_x;
+	double								dy		= event->delta_y;
 
-	wlr_cursor_move(server->cursor, event->device, event->delta_x, event->delta_y);
+	RecordMotion(server, event);
+	IdleActivity(server);
+
+	/*
+		Send the raw motion to clients that asked for it, and apply any active
+		pointer constraint. A locked pointer doesn't move at all, so there is no
+		need to do any hit-testing or focus changes.
+	*/
+	if (!ConstraintMotion(server, event->time_msec, &dx, &dy, event->unaccel_dx, event->unaccel_dy)) {
+		return;
+	}
+
+	wlr_cursor_move(server->cursor, event->device, dx, dy);
 	handleCursorMotion(server, event->time_msec);
 }
 
@@ -173,6 +232,13 @@ static void cursorMotionAbsolute(struct wl_listener *listener, void *data)
 	mwdServer									*server	= wl_container_of(listener, server, cursorMotionAbsolute);
 	struct wlr_event_pointer_motion_absolute	*event	= data;
 
+	RecordMotionAbsolute(server, event);
+	IdleActivity(server);
+
+	if (ConstraintIsLocked(server)) {
+		return;
+	}
+
 	wlr_cursor_warp_absolute(server->cursor, event->device, event->x, event->y);
 	handleCursorMotion(server, event->time_msec);
 }
@@ -185,8 +251,20 @@ static void cursorButton(struct wl_listener *listener, void *data)
 	double								sx, sy;
 	struct wlr_surface					*surface;
 
+	RecordButton(server, event);
+	IdleActivity(server);
+
 	if (event->state == WLR_BUTTON_RELEASED) {
 		/* If you released any buttons, we exit interactive move/resize mode. */
+		if (server->grab.mode == MWD_GRAB_MOVE && server->grab.view) {
+			/* The view belongs to whichever output it was dropped on */
+			TagSetOutput(server->grab.view, OutputAt(server, server->cursor->x, server->cursor->y));
+		}
+
+		/* Make sure the client gets the final position right away */
+		if (server->grab.mode != MWD_GRAB_NONE) {
+			ViewFlush(server->grab.view);
+		}
 		server->grab.mode = MWD_GRAB_NONE;
 	} else {
 		/* Focus that client if the button was _pressed_ */
@@ -210,6 +288,7 @@ static void cursorButton(struct wl_listener *listener, void *data)
 
 	/* Notify the client with pointer focus that a button press has occurred */
 	wlr_seat_pointer_notify_button(server->seat, event->time_msec, event->button, event->state);
+	LatencyInput(ViewFindBySurface(server, server->seat->pointer_state.focused_surface), event->time_msec);
 }
 
 static void cursorAxis(struct wl_listener *listener, void *data)
@@ -217,15 +296,34 @@ static void cursorAxis(struct wl_listener *listener, void *data)
 	/* Axis event (ie scroll wheel) */
 	mwdServer						*server = wl_container_of(listener, server, cursorAxis);
 	struct wlr_event_pointer_axis	*event = data;
+	mwdOutput						*output;
+
+	RecordAxis(server, event);
+	IdleActivity(server);
+
+	/* alt or logo with the scroll wheel scrolls the scrolling layout */
+	if ((server->modifiers & (WLR_MODIFIER_ALT | WLR_MODIFIER_LOGO)) &&
+		event->orientation == WLR_AXIS_ORIENTATION_VERTICAL
+	) {
+		output = OutputAt(server, server->cursor->x, server->cursor->y);
+
+		if (output && output->tile.kind == MWD_TILE_SCROLLING) {
+			TileScroll(output, event->delta * 10);
+			return;
+		}
+	}
 
 	/* Notify the client with pointer focus of the axis event. */
 	wlr_seat_pointer_notify_axis(server->seat, event->time_msec, event->orientation, event->delta, event->delta_discrete, event->source);
+	LatencyInput(ViewFindBySurface(server, server->seat->pointer_state.focused_surface), event->time_msec);
 }
 
 static void cursorFrame(struct wl_listener *listener, void *data)
 {
 	mwdServer		*server = wl_container_of(listener, server, cursorFrame);
 
+	RecordFrame(server);
+
 	/* Notify the client with pointer focus of the frame event. */
 	wlr_seat_pointer_notify_frame(server->seat);
 }
@@ -244,6 +342,100 @@ static void kbdHandleModifiers(struct wl_listener *listener, void *data)
 	// wlr_log(WLR_INFO, "modifiers: %08x", server->modifiers);
 }
 
+/*
+	alt or logo with a number key selects a tag on the output with the cursor,
+	with control it toggles the tag, with shift the focused view is moved to the
+	tag instead, and with both the tag is toggled for the focused view. 0 means
+	all tags.
+
+	The keycode is used instead of the keysym because shift changes the keysym.
+*/
+static bool kbdHandleTag(mwdServer *server, uint32_t keycode, uint32_t modifiers)
+{
+	mwdOutput		*output	= OutputAt(server, server->cursor->x, server->cursor->y);
+	mwdView			*view	= ViewFocused(server);
+	uint32_t		tags;
+
+	if (keycode < KEY_1 || keycode > KEY_0) {
+		return false;
+	}
+	tags = (keycode == KEY_0) ? MWD_TAG_ALL : (1 << (keycode - KEY_1));
+
+	switch (modifiers & (WLR_MODIFIER_SHIFT | WLR_MODIFIER_CTRL)) {
+		case 0:
+			TagSelect(output, tags);
+			break;
+
+		case WLR_MODIFIER_CTRL:
+			TagToggle(output, tags);
+			break;
+
+		case WLR_MODIFIER_SHIFT:
+			TagSetView(view, tags);
+			break;
+
+		case WLR_MODIFIER_SHIFT | WLR_MODIFIER_CTRL:
+			TagToggleView(view, tags);
+			break;
+	}
+	return true;
+}
+
+/*
+	Handle the layout bindings. These only work with the logo key held, since
+	alt with the same keys (ie alt+d, alt+Tab) is used by plenty of clients.
+*/
+static bool kbdHandleLayout(mwdServer *server, xkb_keysym_t sym)
+{
+	mwdOutput		*output	= OutputAt(server, server->cursor->x, server->cursor->y);
+	mwdView			*view;
+
+	switch (sym) {
+		case XKB_KEY_h:
+			TileAdjustRatio(output, -MWD_TILE_RATIO_STEP);
+			return true;
+
+		case XKB_KEY_l:
+			TileAdjustRatio(output, MWD_TILE_RATIO_STEP);
+			return true;
+
+		case XKB_KEY_i:
+			TileAdjustCount(output, 1);
+			return true;
+
+		case XKB_KEY_d:
+			TileAdjustCount(output, -1);
+			return true;
+
+		case XKB_KEY_t:
+			TileSetKind(output, MWD_TILE_MASTER_STACK);
+			return true;
+
+		case XKB_KEY_m:
+			TileSetKind(output, MWD_TILE_COLUMNS);
+			return true;
+
+		case XKB_KEY_s:
+			TileSetKind(output, MWD_TILE_SCROLLING);
+			return true;
+
+		case XKB_KEY_Tab:
+			TagSelectPrevious(output);
+			return true;
+
+		case XKB_KEY_space:
+			/* Toggle floating for the focused view */
+			if ((view = ViewFocused(server))) {
+				view->floating = !view->floating;
+				TileMarkTagsDirty(view->output, view->tags);
+			}
+			return true;
+
+		default:
+			return false;
+	}
+}
+
 /* A key has been pressed or released */
 static void kbdHandleKey(struct wl_listener *listener, void *data)
 {
@@ -255,6 +447,9 @@ static void kbdHandleKey(struct wl_listener *listener, void *data)
 	uint32_t						keycode;
 	uint32_t						modifiers;
 
+	RecordKey(server, event);
+	IdleActivity(server);
+
 	/* Translate libinput keycode -> xkbcommon */
 	keycode = event->keycode + 8;
 
@@ -263,6 +458,23 @@ static void kbdHandleKey(struct wl_listener *listener, void *data)
 
 	modifiers = wlr_keyboard_get_modifiers(keyboard->device->keyboard);
 
+	/* Apply any per application remapping for the focused view */
+	switch (event->state) {
+		case WL_KEYBOARD_KEY_STATE_PRESSED:
+			if (RemapKeyPress(keyboard, event->time_msec, event->keycode, modifiers)) {
+				LatencyInput(ViewFocused(server), event->time_msec);
+				return;
+			}
+			break;
+
+		case WL_KEYBOARD_KEY_STATE_RELEASED:
+			if (RemapKeyRelease(keyboard, event->time_msec, event->keycode)) {
+				LatencyInput(ViewFocused(server), event->time_msec);
+				return;
+			}
+			break;
+	}
+
 	// TODO Compare this event to a configured list of keybindings that the user
 	//		has provided.
 
@@ -271,7 +483,15 @@ static void kbdHandleKey(struct wl_listener *listener, void *data)
 	if (modifiers & (WLR_MODIFIER_ALT | WLR_MODIFIER_LOGO)) {
 		switch (event->state) {
 			case WL_KEYBOARD_KEY_STATE_PRESSED:
+				if (kbdHandleTag(server, event->keycode, modifiers)) {
+					return;
+				}
+
 				for (int i = 0; i < nsyms; i++) {
+					if ((modifiers & WLR_MODIFIER_LOGO) && kbdHandleLayout(server, syms[i])) {
+						return;
+					}
+
 					switch (syms[i]) {
 						case XKB_KEY_XF86Switch_VT_1:
 						case XKB_KEY_XF86Switch_VT_2:
@@ -320,6 +540,9 @@ static void kbdHandleKey(struct wl_listener *listener, void *data)
 
 			case WL_KEYBOARD_KEY_STATE_RELEASED:
 				/* Cancel any grab that was in progress */
+				if (server->grab.mode != MWD_GRAB_NONE) {
+					ViewFlush(server->grab.view);
+				}
 				server->grab.mode = MWD_GRAB_NONE;
 				break;
 		}
@@ -328,6 +551,7 @@ static void kbdHandleKey(struct wl_listener *listener, void *data)
 	/* Otherwise, we pass it along to the client. */
 	wlr_seat_set_keyboard(server->seat, keyboard->device);
 	wlr_seat_keyboard_notify_key(server->seat, event->time_msec, event->keycode, event->state);
+	LatencyInput(ViewFocused(server), event->time_msec);
 }
 
 static void newKeyboard(mwdServer *server, struct wlr_input_device *device)
@@ -414,6 +638,15 @@ static void requestCursor(struct wl_listener *listener, void *data)
 	wlr_cursor_set_surface(server->cursor, event->surface, event->hotspot_x, event->hotspot_y);
 }
 
+/* The keyboard focus changed, either by mwd or because the surface went away */
+static void keyboardFocus(struct wl_listener *listener, void *data)
+{
+	mwdServer									*server	= wl_container_of(listener, server, keyboardFocus);
+	struct wlr_seat_keyboard_focus_change_event	*event	= data;
+
+	RemapFocus(server, event->new_surface);
+}
+
 void inputMain(mwdServer *server)
 {
 	wl_list_init(&server->keyboards);
@@ -431,6 +664,7 @@ void inputMain(mwdServer *server)
 	server->cursorFrame.notify			= cursorFrame;
 	server->newInput.notify				= newInput;
 	server->requestCursor.notify		= requestCursor;
+	server->keyboardFocus.notify		= keyboardFocus;
 
 	wl_signal_add(&server->cursor->events.motion,			&server->cursorMotionRelative);
 	wl_signal_add(&server->cursor->events.motion_absolute,	&server->cursorMotionAbsolute);
@@ -443,5 +677,6 @@ void inputMain(mwdServer *server)
 	server->seat = wlr_seat_create(server->display, "seat0");
 
 	wl_signal_add(&server->seat->events.request_set_cursor,	&server->requestCursor);
+	wl_signal_add(&server->seat->keyboard_state.events.focus_change, &server->keyboardFocus);
 }
 
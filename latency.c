@@ -0,0 +1,101 @@
+#include "../mwd.h"
+
+/*
+	Input to present latency
+
+	When an input event is sent to a client the view that received it is tagged
+	with the event's timestamp. The next commit from that view moves the tag to
+	a committed state, and the next frame that renders the view carries it to
+	the output. When that frame is presented the difference between the present
+	timestamp and the input timestamp is added to the output's histogram.
+
+	Only the oldest unanswered event is tracked per view, so a burst of motion
+	events that results in a single commit is measured from the first event.
+
+	The input timestamps from libinput are in milliseconds using the monotonic
+	clock, and only 32 bits wide, so all math is done with wrapping uint32_t.
+*/
+
+/* An input event with the specified time was sent to the view */
+void LatencyInput(mwdView *view, uint32_t time)
+{
+	if (!view || view->latency.input) {
+		return;
+	}
+
+	/* 0 is used to mean "no event", so nudge an event at exactly 0 */
+	view->latency.input = time ? time : 1;
+}
+
+/* The view has committed new state; anything it was sent is now reflected */
+void LatencyCommit(mwdView *view)
+{
+	if (!view || !view->latency.input) {
+		return;
+	}
+
+	if (!view->latency.committed) {
+		view->latency.committed = view->latency.input;
+	}
+	view->latency.input = 0;
+}
+
+/* The view is being rendered on the specified output */
+void LatencyRender(mwdView *view, mwdOutput *output)
+{
+	uint32_t	committed;
+
+	if (!view || !(committed = view->latency.committed)) {
+		return;
+	}
+	view->latency.committed = 0;
+
+	/* Keep the oldest event if multiple views are rendered in this frame */
+	if (!output->latency.frame ||
+		(int32_t) (committed - output->latency.frame) < 0
+	) {
+		output->latency.frame = committed;
+	}
+}
+
+/* The frame has been committed to the output */
+void LatencyFrameCommitted(mwdOutput *output)
+{
+	if (!output->latency.frame) {
+		return;
+	}
+
+	output->latency.pending		= output->latency.frame;
+	output->latency.frame		= 0;
+}
+
+static void LatencyPresent(struct wl_listener *listener, void *data)
+{
+	mwdOutput							*output	= wl_container_of(listener, output, latency.present);
+	struct wlr_output_event_present		*event	= data;
+	uint32_t							now;
+
+	/*
+		A new frame isn't started until the previous one has been presented, so
+		the first present after the commit belongs to the tagged frame.
+	*/
+	if (!output->latency.pending) {
+		return;
+	}
+
+	if (event->when) {
+		now = (uint32_t) (event->when->tv_sec * 1000 + event->when->tv_nsec / 1000000);
+		HistogramAdd(&output->latency.hist, (uint64_t) (uint32_t) (now - output->latency.pending) * 1000);
+	}
+
+	output->latency.pending = 0;
+}
+
+void LatencyOutputInit(mwdOutput *output)
+{
+	HistogramInit(&output->latency.hist, "input to present latency");
+
+	output->latency.present.notify = LatencyPresent;
+	wl_signal_add(&output->output->events.present, &output->latency.present);
+}
+
@@ -1,5 +1,4 @@
 #include "../mwd.h"
-#include <wlr/types/wlr_layer_shell_v1.h>
 
 static bool LayerIsValid(mwdView *view)
 {
@@ -18,6 +17,12 @@ static struct wlr_surface *LayerGetSurface(mwdView *view)
 	return view->layer.surface->surface;
 }
 
+/* Popups aren't tracked, so they may be anywhere */
+static bool LayerIsUnbounded(mwdView *view)
+{
+	return LayerIsValid(view);
+}
+
 static void LayerDestroyView(mwdView *view)
 {
 	if (!LayerIsValid(view)) {
@@ -26,9 +31,13 @@ static void LayerDestroyView(mwdView *view)
 
 	wl_list_remove(&view->link.drawOrder);
 	/* Note; this is not in the userOrder list */
+	wl_list_remove(&view->layer.commit.link);
 
 	view->type = MWD_UNKNOWN;
-	free(view);
+
+	/* Give the space it reserved back */
+	LayerArrange(view->output);
+	StoreFree(view);
 }
 
 static void LayerEachSurface(mwdView *view, wlr_surface_iterator_func_t iterator, void *user_data)
@@ -46,7 +55,9 @@ static void LayerSetPos(mwdView *view, double top, double right, double bottom,
 		return;
 	}
 
-	if (view->top		== top		&&
+	/* The first configure has to be sent even if the position is unchanged */
+	if (view->layer.surface->configured	&&
+		view->top		== top		&&
 		view->right		== right	&&
 		view->bottom	== bottom	&&
 		view->left		== left
@@ -58,6 +69,7 @@ static void LayerSetPos(mwdView *view, double top, double right, double bottom,
 	view->right		= right;
 	view->bottom	= bottom;
 	view->left		= left;
+	ViewGeometryChanged(view);
 
 	wlr_layer_surface_v1_configure(view->layer.surface, right - left, bottom - top);
 }
@@ -82,87 +94,203 @@ void LayerGetPos(mwdView *view, double *ptop, double *pright, double *pbottom, d
 	}
 }
 
-// TODO Add support for exclusive_zone
-// TODO Add support for keyboard_interactive
-// TODO Add support for margin
-static void LayerAnchor(mwdView *view, mwdOutput *output)
+static mwdLayer LayerRenderLayer(enum zwlr_layer_shell_v1_layer layer)
 {
-	struct wlr_layer_surface_v1_state		state;
-    uint32_t								outputw, outputh;
-    uint32_t								desiredw, desiredh;
-	double									top, right, bottom, left;
+	switch (layer) {
+		case ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND:	return MWD_LAYER_BACKGROUND;
+		case ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM:		return MWD_LAYER_BOTTOM;
+		case ZWLR_LAYER_SHELL_V1_LAYER_TOP:			return MWD_LAYER_TOP;
+		case ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY:		return MWD_LAYER_OVERLAY;
+	}
+
+	return MWD_LAYER_TOP;
+}
+
+/*
+	Place a surface along one axis. A size of 0 means the surface wants to be
+	stretched between the two edges, which it must be anchored to.
+*/
+static void LayerPlace(double start, double end, uint32_t size, bool anchorStart, bool anchorEnd,
+		uint32_t marginStart, uint32_t marginEnd, double *pstart, double *pend)
+{
+	if (size == 0) {
+		*pstart	= start + marginStart;
+		*pend	= end - marginEnd;
+		return;
+	}
+
+	if (anchorStart && !anchorEnd) {
+		*pstart	= start + marginStart;
+	} else if (anchorEnd && !anchorStart) {
+		*pstart	= end - marginEnd - size;
+	} else {
+		/* Anchored to both or neither; center it */
+		*pstart	= start + ((end - start) - size) / 2;
+	}
+	*pend = *pstart + size;
+}
+
+/* Remove the exclusive zone of a surface from the usable area */
+static void LayerExclude(struct wlr_layer_surface_v1_state *state, mwdTileBox *usable)
+{
+	uint32_t		anchor	= state->anchor;
+	uint32_t		both;
+
+	/* The zone only applies if anchored to one edge, or one edge and both of its neighbors */
+	both = ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT;
+	if ((anchor & both) == both && (anchor & ~both)) {
+		anchor &= ~both;
+	}
 
-	state = view->layer.surface->current;
+	both = ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP | ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM;
+	if ((anchor & both) == both && (anchor & ~both)) {
+		anchor &= ~both;
+	}
 
-	switch (state.layer) {
-		case ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND:
-			view->renderLayer = MWD_LAYER_BACKGROUND;
+	switch (anchor) {
+		case ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP:
+			usable->top		+= state->exclusive_zone + state->margin.top;
 			break;
 
-		case ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM:
-			view->renderLayer = MWD_LAYER_BOTTOM;
+		case ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM:
+			usable->bottom	-= state->exclusive_zone + state->margin.bottom;
 			break;
 
-		case ZWLR_LAYER_SHELL_V1_LAYER_TOP:
-			view->renderLayer = MWD_LAYER_TOP;
+		case ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT:
+			usable->left	+= state->exclusive_zone + state->margin.left;
 			break;
 
-		case ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY:
-			view->renderLayer = MWD_LAYER_OVERLAY;
+		case ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT:
+			usable->right	-= state->exclusive_zone + state->margin.right;
 			break;
 	}
+}
 
-    outputw = output->output->width;
-    outputh = output->output->height;
-
-	desiredw = state.desired_width;
-	if (desiredw == 0) {
-		desiredw = outputw;
-	}
-	desiredh = state.desired_height;
-	if (desiredh == 0) {
-		desiredh = outputh;
-	}
+static void LayerArrangeLayer(mwdOutput *output, enum zwlr_layer_shell_v1_layer layer,
+		mwdTileBox *full, mwdTileBox *usable, bool exclusive)
+{
+	struct wlr_layer_surface_v1_state		*state;
+	mwdView									*view;
+	mwdTileBox								*bounds;
+	double									top, right, bottom, left;
 
-	if (state.anchor & (ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT)) {
-		/* Anchored to one or both of the sides */
-		if (state.anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT) {
-			left	= 0;
-		} else {
-			left	= outputw - desiredw;
+	wl_list_for_each(view, &output->server->views.drawOrder, link.drawOrder) {
+		if (view->type != MWD_LAYER_SHELL || view->output != output) {
+			continue;
 		}
+		state = &view->layer.surface->current;
 
-		if (state.anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT) {
-			right = outputw;
-		} else {
-			right = desiredw;
+		if (state->layer != layer || (state->exclusive_zone > 0) != exclusive) {
+			continue;
 		}
-	} else {
-		/* Neither left or right was anchored; Use the requested width and center */
-		left	= (outputw / 2) - (desiredw / 2);
-		right	= (outputw / 2) + (desiredw / 2);
-	}
 
-	if (state.anchor & (ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP | ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM)) {
-		/* Anchored to one or both of the sides */
-		if (state.anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP) {
-			top	= 0;
-		} else {
-			top	= outputh - desiredh;
+		/* A zone of -1 asks to ignore the zones of other surfaces */
+		bounds = state->exclusive_zone == -1 ? full : usable;
+
+		LayerPlace(bounds->left, bounds->right, state->desired_width,
+				state->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT,
+				state->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT,
+				state->margin.left, state->margin.right, &left, &right);
+
+		LayerPlace(bounds->top, bounds->bottom, state->desired_height,
+				state->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP,
+				state->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM,
+				state->margin.top, state->margin.bottom, &top, &bottom);
+
+		view->renderLayer = LayerRenderLayer(state->layer);
+
+		if (right <= left || bottom <= top) {
+			wlr_log(WLR_ERROR, "Closing layer surface with no size: %s", view->layer.surface->namespace);
+			wlr_layer_surface_v1_close(view->layer.surface);
+			continue;
 		}
 
-		if (state.anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM) {
-			bottom = outputh;
-		} else {
-			bottom = desiredh;
+		LayerSetPos(view, top, right, bottom, left);
+		ViewSyncStore(view);
+
+		if (exclusive && view->layer.surface->mapped) {
+			LayerExclude(state, usable);
 		}
-	} else {
-		/* Neither top or bottom was anchored; Use the requested height and center */
-		top		= (outputh / 2) - (desiredh / 2);
-		bottom	= (outputh / 2) + (desiredh / 2);
+	}
+}
+
+/*
+	Position all of the layer surfaces on an output, and find the area that is
+	left for other views once the exclusive zones have been removed.
+
+	Surfaces with an exclusive zone are placed first, starting with the top
+	most layer, so that stacked panels don't overlap. The result is cached on
+	the output, and this is only run again when a layer surface commits new
+	state or the output changes.
+*/
+void LayerArrange(mwdOutput *output)
+{
+	static const enum zwlr_layer_shell_v1_layer	layers[] = {
+		ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY,
+		ZWLR_LAYER_SHELL_V1_LAYER_TOP,
+		ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM,
+		ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND
+	};
+	struct wlr_box			*box;
+	mwdTileBox				full;
+	mwdTileBox				usable;
+
+	if (!output || !(box = wlr_output_layout_get_box(output->server->layout, output->output))) {
+		return;
+	}
+
+	full.left	= box->x;
+	full.top	= box->y;
+	full.right	= box->x + box->width;
+	full.bottom	= box->y + box->height;
+	usable		= full;
+
+	for (int i = 0; i < 4; i++) {
+		LayerArrangeLayer(output, layers[i], &full, &usable, true);
+	}
+	for (int i = 0; i < 4; i++) {
+		LayerArrangeLayer(output, layers[i], &full, &usable, false);
 	}
 
-	LayerSetPos(view, top, right, bottom, left);
+	if (usable.top		!= output->usableArea.top		||
+		usable.right	!= output->usableArea.right		||
+		usable.bottom	!= output->usableArea.bottom	||
+		usable.left		!= output->usableArea.left
+	) {
+		output->usableArea = usable;
+		TileMarkDirty(output);
+	}
+}
+
+// TODO Add support for keyboard_interactive
+
+/* Only arrange when the state that affects placement has changed */
+static void LayerCommit(struct wl_listener *listener, void *data)
+{
+	mwdView								*view		= wl_container_of(listener, view, layer.commit);
+	struct wlr_layer_surface_v1			*surface	= view->layer.surface;
+	struct wlr_layer_surface_v1_state	*state		= &surface->current;
+
+	if (view->layer.arranged.valid &&
+		view->layer.arranged.mapped					== surface->mapped			&&
+		view->layer.arranged.state.anchor			== state->anchor			&&
+		view->layer.arranged.state.exclusive_zone	== state->exclusive_zone	&&
+		view->layer.arranged.state.margin.top		== state->margin.top		&&
+		view->layer.arranged.state.margin.right		== state->margin.right		&&
+		view->layer.arranged.state.margin.bottom	== state->margin.bottom		&&
+		view->layer.arranged.state.margin.left		== state->margin.left		&&
+		view->layer.arranged.state.desired_width	== state->desired_width		&&
+		view->layer.arranged.state.desired_height	== state->desired_height	&&
+		view->layer.arranged.state.layer			== state->layer
+	) {
+		return;
+	}
+
+	LayerArrange(view->output);
+
+	view->layer.arranged.state	= *state;
+	view->layer.arranged.mapped	= surface->mapped;
+	view->layer.arranged.valid	= true;
 }
 
 static bool LayerIsVisible(mwdView *view, mwdOutput *output)
@@ -171,10 +299,7 @@ static bool LayerIsVisible(mwdView *view, mwdOutput *output)
 		return false;
 	}
 
-	/* Position the view if needed */
-	LayerAnchor(view, output);
-
-	return true;
+	return view->output == output;
 }
 
 static bool LayerIsAt(mwdView *view, double x, double y, struct wlr_surface **psurface, double *offsetX, double *offsetY)
@@ -239,6 +364,7 @@ mwdViewInterface LayerShellViewInterface = {
 		.valid			= &LayerIsValid,
 		.visible		= &LayerIsVisible,
 		.at				= &LayerIsAt,
+		.unbounded		= &LayerIsUnbounded,
 	},
 
 	.foreach = {
@@ -266,18 +392,28 @@ static void LayerNewSurface(struct wl_listener *listener, void *data)
 	view->cb			= &LayerShellViewInterface;
 
 	/* Listen to the various events it can emit */
+	view->layer.commit.notify = LayerCommit;
+
 	wl_signal_add(&surface->events.map,			&view->map);
 	wl_signal_add(&surface->events.unmap,		&view->unmap);
 	wl_signal_add(&surface->events.destroy,		&view->destroy);
+	wl_signal_add(&surface->surface->events.commit,	&view->layer.commit);
 
 	/* Add it to the draw order list only. A user can't select this. */
 	wl_list_insert(&server->views.drawOrder, &view->link.drawOrder);
 
-	if ((output = OutputFind(server, view->layer.surface->output))) {
-		view->layer.surface->output = output->output;
+	/* Layer surfaces are shown on every tag */
+	view->tags = MWD_TAG_ALL;
+
+	if (!(output = OutputFind(server, view->layer.surface->output))) {
+		/* There is nowhere to put it */
+		wlr_layer_surface_v1_close(surface);
+		return;
 	}
+	view->layer.surface->output	= output->output;
+	view->output				= output;
 
-	LayerAnchor(view, output);
+	/* It is arranged once the client commits its initial state */
 }
 
 void LayerMain(mwdServer *server)
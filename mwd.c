@@ -1,4 +1,5 @@
 #include "mwd.h"
+#include <wlr/backend/headless.h>
 
 static void setSelection(struct wl_listener *listener, void *data)
 {
@@ -14,29 +15,105 @@ int main(int argc, char **argv)
 	char				*rcfile = "./mwdrc"; // TODO Set a better default value; ie $XDG_CONFIG_HOME/mwd/mwdrc
 	int					c;
 	const char			*socket;
+	const char			*recordFile	= NULL;
+	const char			*replayFile	= NULL;
+	const char			*generator	= NULL;
 
 	memset(&server, 0, sizeof(server));
 
 	// TODO Let the user call this again to change the verbosity
 	wlr_log_init(WLR_DEBUG, NULL);
 
-	while (-1 != (c = getopt(argc, argv, "s:h"))) {
+	/* Rules are added while parsing the arguments */
+	RemapMain(&server);
+	RulesMain(&server);
+
+	while (-1 != (c = getopt(argc, argv, "s:k:r:R:P:l:x:o:i:V:c:h"))) {
 		switch (c) {
 			case 's':
 				rcfile = optarg;
 				break;
 
+			case 'k':
+				/* ie: -k "kitty:logo+c=ctrl+shift+c" */
+				if (!RemapAddRule(&server, optarg)) {
+					return 1;
+				}
+				break;
+
+			case 'r':
+				/* ie: -r "firefox:tags=2" */
+				if (!RulesAdd(&server, optarg)) {
+					return 1;
+				}
+				break;
+
+			case 'R':
+				recordFile = optarg;
+				break;
+
+			case 'P':
+				replayFile = optarg;
+				break;
+
+			case 'l':
+				generator = optarg;
+				break;
+
+			case 'x':
+				/* ie: -x prewarm:300 */
+				if (!XWaylandSetPolicy(&server, optarg)) {
+					return 1;
+				}
+				break;
+
+			case 'i':
+				/* ie: -i 60 */
+				if (!IdleSetDownclock(&server, optarg)) {
+					return 1;
+				}
+				break;
+
+			case 'V':
+				/* ie: -V ~/.config/mwd/virtual */
+				if (!VirtualSetPath(&server, optarg)) {
+					return 1;
+				}
+				break;
+
+			case 'c':
+				/* ie: -c 4 */
+				if (!ComposeSetThreads(&server, optarg)) {
+					return 1;
+				}
+				break;
+
+			case 'o':
+				/* ie: -o ~/.config/mwd/outputs */
+				if (!ProfileSetPath(&server, optarg)) {
+					return 1;
+				}
+				break;
+
 			default:
-				printf("Usage: %s [-s startup command]\n", argv[0]);
+				printf("Usage: %s [-s startup command] [-k app_id:keys=keys] [-r app_id:rule] [-R record file] [-P replay file] [-l layout command] [-x lazy|prewarm[:seconds]] [-o output profiles] [-i idle downclock seconds] [-V virtual outputs] [-c composition threads]\n", argv[0]);
 				return 0;
 		}
 	}
 
 	if (optind < argc) {
-		printf("Usage: %s [-s startup command]\n", argv[0]);
+		printf("Usage: %s [-s startup command] [-k app_id:keys=keys] [-r app_id:rule] [-R record file] [-P replay file] [-l layout command] [-x lazy|prewarm[:seconds]] [-o output profiles] [-i idle downclock seconds] [-V virtual outputs] [-c composition threads]\n", argv[0]);
 		return 0;
 	}
 
+	if (!RulesCompile(&server)) {
+		return 1;
+	}
+
+	if (replayFile && !ReplayOpen(&server, replayFile)) {
+		return 1;
+	}
+
 	/* Create the wayland display */
 	server.display = wl_display_create();
 
@@ -45,12 +122,23 @@ int main(int argc, char **argv)
 
 		The backend abstracts the input and output hardware. Using autocreate
 		will pick the most suitable backend for us (X11 window vs TTY)
+
+		A replay always uses the headless backend, so that the only input is
+		the recorded input.
 	*/
-	server.backend = wlr_backend_autocreate(server.display, NULL);
+	if (replayFile) {
+		server.backend = wlr_headless_backend_create(server.display, NULL);
+	} else {
+		server.backend = wlr_backend_autocreate(server.display, NULL);
+	}
 	server.renderer = wlr_backend_get_renderer(server.backend);
 	wlr_renderer_init_wl_display(server.renderer, server.display);
 
 	server.compositor = wlr_compositor_create(server.display, server.renderer);
+
+	/* Software composition, if enabled, keeps a copy of every surface */
+	ComposeMain(&server);
+
 	wlr_data_device_manager_create(server.display);
 
 	server.layout = wlr_output_layout_create();
@@ -65,6 +153,12 @@ int main(int argc, char **argv)
 	*/
 	wl_list_init(&server.views.drawOrder);
 	wl_list_init(&server.views.userOrder);
+	StoreMain(&server);
+	TagMain(&server);
+	GeneratorMain(&server);
+
+	/* Layout changes are applied atomically */
+	TransactionMain(&server);
 
 	/*
 		xdg shell
@@ -91,6 +185,7 @@ int main(int argc, char **argv)
 
 	/* Register for notifications when there is a new output */
 	wl_list_init(&server.outputs);
+	ProfileMain(&server);
 	server.output.added.notify = OutputAdd;
 	wl_signal_add(&server.backend->events.new_output, &server.output.added);
 
@@ -109,13 +204,26 @@ int main(int argc, char **argv)
 	server.output.test.notify = OutputTestCfg;
 	wl_signal_add(&server.output.mgr->events.test, &server.output.test);
 
+	/*
+		Setup the output power manager
+
+		This implements the wlr-output-power-management protocol, which lets
+		clients (ie swayidle) turn outputs off and back on.
+	*/
+	server.output.power = wlr_output_power_manager_v1_create(server.display);
+
+	server.output.setPower.notify = OutputSetPower;
+	wl_signal_add(&server.output.power->events.set_mode, &server.output.setPower);
+
+	/*
+		Setup screencopy, so clients can capture outputs (ie to share them),
+		and the virtual outputs which only render while being captured.
+	*/
+	server.output.screencopy = wlr_screencopy_manager_v1_create(server.display);
+	VirtualMain(&server);
+
 	// TODO Decoration manager
-	// TODO Idle
-	// TODO relative_pointer_manager
-	// TODO pointer_constraints
-	// TODO output_power_manager_v1
 	// TODO dmabuf_manager
-	// TODO screencopy_manager
 	// TODO all the other managers
 
 
@@ -123,6 +231,25 @@ int main(int argc, char **argv)
 	XWaylandMain(&server);
 	inputMain(&server);
 
+	/*
+		Idle and idle inhibit
+
+		Lets clients know when the user is idle, unless a visible surface (ie a
+		video player) inhibits it, and downclocks the outputs.
+	*/
+	IdleMain(&server);
+
+	/*
+		Relative pointer and pointer constraints
+
+		These let clients such as games lock or confine the pointer and receive
+		unaccelerated motion.
+	*/
+	ConstraintMain(&server);
+
+	/* Dump instrumentation on SIGUSR1 */
+	StatsMain(&server);
+
 	server.setSelection.notify = setSelection;
 	wl_signal_add(&server.seat->events.request_set_selection, &server.setSelection);
 
@@ -140,12 +267,31 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (replayFile && !ReplayStart(&server)) {
+		wlr_backend_destroy(server.backend);
+		wl_display_destroy(server.display);
+		return 1;
+	}
+
+	if (recordFile && !RecordStart(&server, recordFile)) {
+		wlr_backend_destroy(server.backend);
+		wl_display_destroy(server.display);
+		return 1;
+	}
+
 	/*
 		Set the WAYLAND_DISPLAY environment variable to point to our socket and
 		then run the configured rc file.
 	*/
 	setenv("WAYLAND_DISPLAY", socket, true);
 
+	/* The layout generator gets the same environment as the rc file */
+	if (generator && !GeneratorStart(&server, generator)) {
+		wlr_backend_destroy(server.backend);
+		wl_display_destroy(server.display);
+		return 1;
+	}
+
 	if (rcfile && fork() == 0) {
 		/* Child */
 		execl("/bin/sh", "/bin/sh", "-c", rcfile, (void *)NULL);
@@ -159,6 +305,13 @@ int main(int argc, char **argv)
 	wl_display_run(server.display);
 
 	/* Cleanup */
+	StatsDump(&server);
+	ComposeStop(&server);
+	GeneratorStop(&server);
+	RecordStop(&server);
+	ReplayStop(&server);
+	XWaylandStop(&server);
+
 	wl_display_destroy_clients(server.display);
 	wl_display_destroy(server.display);
 	return 0;
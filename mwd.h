@@ -3,9 +3,14 @@
 
 #define _POSIX_C_SOURCE 200809L
 #include <getopt.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
@@ -23,7 +28,13 @@
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/types/wlr_output_management_v1.h>
+#include <wlr/types/wlr_output_power_management_v1.h>
+#include <wlr/types/wlr_idle.h>
+#include <wlr/types/wlr_idle_inhibit_v1.h>
+#include <wlr/types/wlr_screencopy_v1.h>
 #include <wlr/types/wlr_xdg_output_v1.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_layer_shell_v1.h>
 #include <wlr/util/log.h>
 #include <xkbcommon/xkbcommon.h>
 #include <linux/input-event-codes.h>
@@ -56,6 +67,225 @@ typedef enum mwdLayer {
 	MWD_LAYER_AFTER
 } mwdLayer;
 
+/* How much the layout bindings change the master ratio or column width */
+#define MWD_TILE_RATIO_STEP		0.05
+
+#define MWD_TAG_COUNT			9
+#define MWD_TAG_ALL				((1 << MWD_TAG_COUNT) - 1)
+
+#define MWD_HISTOGRAM_BUCKETS	16
+
+typedef struct mwdHistogram
+{
+	const char							*name;
+
+	uint64_t							buckets[MWD_HISTOGRAM_BUCKETS];
+	uint64_t							count;
+	uint64_t							total;
+	uint64_t							min, max;
+} mwdHistogram;
+
+typedef enum mwdTileKind {
+	MWD_TILE_MASTER_STACK,
+	MWD_TILE_COLUMNS,
+	MWD_TILE_SCROLLING
+} mwdTileKind;
+
+typedef struct mwdTileBox
+{
+	double								top, right, bottom, left;
+} mwdTileBox;
+
+/* A surface's pixels, and the box in output pixels to draw them in */
+typedef struct mwdComposeLayer
+{
+	const uint32_t						*pixels;
+	int									stride;
+	int									width, height;
+
+	struct wlr_box						box;
+
+	/* XRGB pixels replace what is below them instead of blending */
+	bool								opaque;
+
+	/* Only used by the main thread, to send frame done once it is shown */
+	struct wlr_surface					*surface;
+} mwdComposeLayer;
+
+typedef struct mwdComposePool
+{
+	pthread_t							*threads;
+	int									count;
+
+	pthread_mutex_t						lock;
+	pthread_cond_t						start;
+	pthread_cond_t						done;
+
+	/* Bumped for every frame, so each worker knows when there is a new one */
+	uint64_t							generation;
+	int									busy;
+	bool								stopping;
+
+	/* The frame being composed; only written while the workers are waiting */
+	struct {
+		uint32_t						*dst;
+		int								width, height;
+		int								stride;
+		uint32_t						background;
+
+		const mwdComposeLayer			*layers;
+		int								count;
+
+		int								tilesX;
+		int								tiles;
+		atomic_int						next;
+	} frame;
+} mwdComposePool;
+
+/* A copy of the pixels of the last shm buffer committed to a surface */
+typedef struct mwdComposeSurface
+{
+	struct wlr_surface					*surface;
+
+	uint32_t							*pixels;
+	int									width, height;
+	bool								opaque;
+
+	struct wl_listener					commit;
+	struct wl_listener					destroy;
+} mwdComposeSurface;
+
+typedef enum mwdGeneratorResult {
+	MWD_GENERATOR_BUILTIN,
+	MWD_GENERATOR_DONE,
+	MWD_GENERATOR_WAITING
+} mwdGeneratorResult;
+
+/* The parameters that an external layout depends on */
+typedef struct mwdGeneratorKey
+{
+	int									count;
+	int									width, height;
+	mwdTileKind							kind;
+	int									masterCount;
+	double								masterRatio;
+	int									columns;
+} mwdGeneratorKey;
+
+typedef struct mwdGeneratorEntry
+{
+	struct wl_list						link;
+	mwdGeneratorKey						key;
+
+	/* Relative to the usable area, or NULL to use the built-in layout */
+	mwdTileBox							*boxes;
+} mwdGeneratorEntry;
+
+typedef struct mwdGeneratorRequest
+{
+	struct wl_list						link;
+	struct mwdServer					*server;
+
+	uint32_t							serial;
+	mwdGeneratorKey						key;
+
+	struct wl_event_source				*timer;
+	bool								timedOut;
+} mwdGeneratorRequest;
+
+#define MWD_GENERATOR_LINE_MAX	(16 * 1024)
+
+typedef struct mwdRule
+{
+	struct wl_list						link;
+	int									index;
+
+	/* NULL matches any app_id or title */
+	char								*appId;
+	char								*title;
+	regex_t								regex;
+
+	/* The next rule with the same app_id */
+	struct mwdRule						*next;
+
+	uint32_t							tags;
+	int									floating;
+} mwdRule;
+
+typedef struct mwdRuleResult
+{
+	/* 0 and -1 mean that no rule set the value */
+	uint32_t							tags;
+	int									floating;
+} mwdRuleResult;
+
+/* The saved state of one monitor in an output profile */
+typedef struct mwdProfileOutput
+{
+	/* The make, model and serial of the monitor */
+	char								*identity;
+
+	bool								enabled;
+	int32_t								width, height;
+	int32_t								refresh;
+	int32_t								x, y;
+	float								scale;
+	enum wl_output_transform			transform;
+} mwdProfileOutput;
+
+/* An output configuration, for one set of connected monitors */
+typedef struct mwdProfile
+{
+	struct wl_list						link;
+
+	/* The sorted identities of the monitors, one per line */
+	char								*key;
+
+	int									count;
+	mwdProfileOutput					*outputs;
+} mwdProfile;
+
+#define MWD_STORE_SLAB			64
+
+typedef uint32_t mwdViewHandle;
+
+/* The fields of a view that every traversal reads, stored contiguously */
+typedef struct mwdViewHot
+{
+	/* NULL if the slot is free */
+	struct mwdView						*view;
+	struct wlr_surface					*surface;
+
+	/* Everything the view draws, and the outputs that it overlaps */
+	mwdTileBox							bounds;
+	uint32_t							outputs;
+
+	uint64_t							seq;
+	uint8_t								layer;
+
+	/* Set if the view may draw (or accept input) outside of its bounds */
+	bool								unbounded;
+} mwdViewHot;
+
+typedef struct mwdStore
+{
+	struct mwdViewSlab					**slabs;
+	uint32_t							slabCount;
+
+	/* Indexed by handle; only the first used entries can be in use */
+	mwdViewHot							*hot;
+	uint32_t							size;
+	uint32_t							used;
+	uint32_t							count;
+
+	/* Stack of free handles */
+	uint32_t							*free;
+	uint32_t							freeCount;
+
+	/* Scratch space for sorting the views being rendered */
+	mwdViewHot							**order;
+} mwdStore;
+
 typedef struct mwdServer
 {
 	struct wl_display					*display;
@@ -72,6 +302,19 @@ typedef struct mwdServer
 	struct {
 		struct wl_list					drawOrder;
 		struct wl_list					userOrder;
+
+		/* Only the views that are on a selected tag, in the same orders */
+		struct {
+			struct wl_list				drawOrder;
+			struct wl_list				userOrder;
+		} visible;
+
+		/* Used to keep the visible lists sorted */
+		uint64_t						drawSeq;
+		uint64_t						userSeq;
+
+		/* Slab allocated views, and their hot fields */
+		mwdStore						store;
 	} views;
 	struct wl_list						keyboards;
 	struct wl_list						outputs;
@@ -84,8 +327,52 @@ typedef struct mwdServer
 
 		struct mwdOutputTest			*pendingTest;
 		bool							applying;
+
+		/* The bits that are in use by an output's mask */
+		uint32_t						masks;
+
+		/* The masks of the outputs that are powered on */
+		uint32_t						powered;
+
+		struct wlr_output_power_manager_v1	*power;
+		struct wl_listener				setPower;
+
+		struct wlr_screencopy_manager_v1	*screencopy;
+
+		/* Layout changes are coalesced, and counted */
+		struct {
+			struct wl_event_source		*idle;
+			struct wl_event_source		*notify;
+			bool						notifyPending;
+
+			uint64_t					changes;
+			uint64_t					updates;
+			uint64_t					notifies;
+		} layout;
 	} output;
 
+	struct {
+		struct wlr_backend				*backend;
+		struct wl_list					list;
+		char							*path;
+		struct wl_event_source			*signal;
+
+		/* Set while a virtual output is being added, so OutputAdd can tell */
+		bool							adding;
+	} virtuals;
+
+	struct {
+		/* Most recently saved first */
+		struct wl_list					list;
+		char							*path;
+
+		/* Applies the profile once the connected outputs settle */
+		struct wl_event_source			*idle;
+
+		/* Set if that was put off because the outputs were downclocked */
+		bool							deferred;
+	} profiles;
+
 	struct wl_listener					cursorMotionRelative;
 	struct wl_listener					cursorMotionAbsolute;
 	struct wl_listener					cursorButton;
@@ -94,9 +381,64 @@ typedef struct mwdServer
 
 	struct wl_listener					newInput;
 	struct wl_listener					requestCursor;
+	struct wl_listener					keyboardFocus;
 	struct wl_listener					setSelection;
 	uint32_t							modifiers;
 
+	struct {
+		struct wlr_idle					*idle;
+		struct wlr_idle_inhibit_manager_v1	*inhibit;
+		struct wl_listener				newInhibitor;
+		struct wl_list					inhibitors;
+
+		/* Set while a visible view has an inhibitor */
+		bool							inhibited;
+
+		/* Downclock the outputs after this many seconds without input; 0 never */
+		int								downclockSecs;
+		struct wl_event_source			*timer;
+		bool							downclocked;
+
+		/* CLOCK_MONOTONIC time of the last input, in milliseconds */
+		uint64_t						last;
+	} idle;
+
+	struct {
+		struct wlr_relative_pointer_manager_v1	*relativeMgr;
+		struct wlr_pointer_constraints_v1		*mgr;
+		struct wl_listener						newConstraint;
+
+		/* The constraint for the focused surface, if any */
+		struct mwdPointerConstraint				*active;
+	} constraints;
+
+	struct {
+		struct wl_list					rules;
+		struct wl_list					tables;
+
+		/* The table for the focused view, or NULL */
+		struct mwdRemapTable			*active;
+	} remap;
+
+	struct {
+		/* All rules, in the order they were given */
+		struct wl_list					list;
+		int								count;
+
+		/* Open addressed hash table of the first rule for each app_id */
+		uint32_t						size;
+		struct {
+			uint32_t					hash;
+			struct mwdRule				*rule;
+		} *table;
+
+		/* Rules for any app_id, and all of their title patterns combined */
+		struct mwdRule					**anyRules;
+		int								anyCount;
+		regex_t							titleSet;
+		bool							hasTitleSet;
+	} rules;
+
 	struct {
 		struct mwdView					*view;
 
@@ -108,6 +450,9 @@ typedef struct mwdServer
 		double							top, right, bottom, left;
 
 		mwdGrabMode						mode;
+
+		/* Set once the cursor has moved far enough to start the move or resize */
+		bool							moved;
 	} grab;
 
 	struct {
@@ -124,7 +469,100 @@ typedef struct mwdServer
 		struct wlr_xwayland				*shell;
 		struct wl_listener				ready;
 		struct wl_listener				newSurface;
+
+		/* Views with a configure waiting to be sent, and the idle to send them */
+		struct wl_list					pending;
+		struct wl_event_source			*flushIdle;
+
+		/* Mapped override-redirect surfaces, newest first */
+		struct wl_list					unmanaged;
+
+		/* Start Xwayland before the first X client, and stop it when unused */
+		bool							prewarm;
+		int								idleSecs;
+		struct wl_event_source			*prewarmTimer;
+		struct wl_event_source			*idleTimer;
+		int								prewarmFd;
+		int								surfaces;
+
+		/* The first window of each instance; warm if it was prewarmed */
+		bool							warm;
+		bool							measured;
+		mwdHistogram					coldHist;
+		mwdHistogram					warmHist;
 	} xwayland;
+
+	struct {
+		/* Arranges any dirty outputs when the event loop is idle */
+		struct wl_event_source			*idle;
+	} tile;
+
+	struct {
+		pid_t							pid;
+		int								fd;
+		struct wl_event_source			*source;
+
+		/* A generator that was told to stop, and hasn't been reaped yet */
+		pid_t							reapPid;
+		int								reapTries;
+		struct wl_event_source			*reapTimer;
+		uint32_t						serial;
+
+		struct wl_list					requests;
+		int								requestCount;
+
+		/* Most recently used first */
+		struct wl_list					cache;
+		int								cacheCount;
+
+		char							in[MWD_GENERATOR_LINE_MAX];
+		size_t							inLen;
+
+		char							*out;
+		size_t							outLen;
+		size_t							outSize;
+
+		uint64_t						hits;
+		uint64_t						misses;
+		uint64_t						timeouts;
+	} generator;
+
+	struct {
+		/* The layout transaction that is in flight, if any */
+		struct mwdTransaction			*active;
+
+		mwdHistogram					hist;
+		uint64_t						timeouts;
+	} transaction;
+
+	struct {
+		/* The number of worker threads, or 0 to render with the renderer */
+		int								threads;
+		mwdComposePool					pool;
+
+		struct wl_listener				newSurface;
+	} compose;
+
+	struct {
+		struct wl_event_source			*signal;
+	} stats;
+
+	struct {
+		FILE							*file;
+		uint32_t						start;
+	} record;
+
+	struct {
+		FILE							*file;
+		struct wl_event_source			*timer;
+		uint32_t						start;
+
+		struct wlr_input_device			*keyboard;
+		struct wlr_input_device			*pointer;
+
+		/* The next event, which has been read but not yet dispatched */
+		struct mwdRecordEvent			*next;
+	} replay;
 } mwdServer;
 
 typedef struct mwdOutput
@@ -134,7 +572,91 @@ typedef struct mwdOutput
 
 	struct wlr_output					*output;
 	struct wl_listener					frame;
+	struct wl_listener					destroy;
 	bool								enabled;
+
+	/* False while powered off by an output power manager client */
+	bool								powered;
+
+	/* Created from the virtual output file, on the headless backend */
+	bool								isVirtual;
+
+	/* A single bit identifying this output in a mwdViewHot's outputs */
+	uint32_t							mask;
+
+	/* The area left after the exclusive zones of layer surfaces */
+	mwdTileBox							usableArea;
+
+	struct {
+		uint32_t						selected;
+		uint32_t						previous;
+
+		/* The views on this output with each tag */
+		struct wl_list					views[MWD_TAG_COUNT];
+
+		/* The time of the last tag switch, until its first frame is shown */
+		struct timespec					switched;
+		bool							switching;
+		mwdHistogram					hist;
+	} tag;
+
+	struct {
+		mwdTileKind						kind;
+		int								masterCount;
+		double							masterRatio;
+		int								columns;
+
+		/* The scrolling layout's column width (as a fraction) and position */
+		struct {
+			double						width;
+			double						offset;
+		} scroll;
+
+		bool							dirty;
+
+		/* The hidden tags that have to be preconfigured, and the area it was for */
+		uint32_t						hiddenDirty;
+		mwdTileBox						hiddenArea;
+	} tile;
+
+	struct {
+		/* Oldest input timestamp reflected in the frame being rendered */
+		uint32_t						frame;
+
+		/* Oldest input timestamp reflected in the committed frame */
+		uint32_t						pending;
+
+		struct wl_listener				present;
+		mwdHistogram					hist;
+	} latency;
+
+	struct {
+		/* The mode to restore, if the output was switched to a slower one */
+		struct wlr_output_mode			*mode;
+
+		/* Set if there is no slower mode, so frames are skipped instead */
+		bool							throttled;
+		uint64_t						last;
+		struct wl_event_source			*timer;
+	} idle;
+
+	struct {
+		/* Set while RenderView is collecting layers instead of drawing */
+		bool							collecting;
+
+		/* Set if a surface can't be composed in software */
+		bool							fallback;
+
+		mwdComposeLayer					*layers;
+		int								count;
+		int								size;
+
+		uint32_t						*pixels;
+		int								width, height;
+		struct wlr_texture				*texture;
+
+		mwdHistogram					hist;
+	} compose;
 } mwdOutput;
 
 typedef struct mwdOutputTest
@@ -151,6 +673,13 @@ typedef struct mwdView
 	struct {
 		struct wl_list					drawOrder;
 		struct wl_list					userOrder;
+
+		struct {
+			struct wl_list				drawOrder;
+			struct wl_list				userOrder;
+		} visible;
+
+		struct wl_list					tag[MWD_TAG_COUNT];
 	} link;
 
 	mwdServer							*server;
@@ -166,15 +695,41 @@ typedef struct mwdView
 		struct {
 			struct wlr_xdg_surface		*surface;
 			bool						activated;
+
+			/*
+				Only one configure that changes the size is allowed to be
+				outstanding at a time. Any size requested while waiting for
+				the client to ack is saved, and sent once it does.
+			*/
+			uint32_t					configureSerial;
+			uint32_t					width, height;
+			bool						deferred;
+
+			struct wl_listener			newPopup;
 		} xdg;
 
 		struct {
 			struct wlr_layer_surface_v1	*surface;
+			struct wl_listener			commit;
+
+			/* The state the surface was last arranged with */
+			struct {
+				struct wlr_layer_surface_v1_state	state;
+				bool					mapped;
+				bool					valid;
+			} arranged;
 		} layer;
 
 		struct {
 			struct wlr_xwayland_surface	*surface;
 			bool						activated;
+
+			/* Set when the size changed, until the client commits */
+			bool						awaitingCommit;
+
+			/* Set when a configure is waiting for the next frame */
+			bool						configurePending;
+			struct wl_list				pendingLink;
 		} xwayland;
 	};
 
@@ -183,13 +738,113 @@ typedef struct mwdView
 	struct wl_listener					destroy;
 	struct wl_listener					requestMove;
 	struct wl_listener					requestResize;
+	struct wl_listener					commit;
 	bool								mapped;
 
+	/* Input event timestamps waiting to be reflected on screen */
+	struct {
+		uint32_t						input;
+		uint32_t						committed;
+	} latency;
+
 	uint32_t							edges;
 	double								top, right, bottom, left;
 	mwdLayer							renderLayer;
+
+	/* The logical and rendered position, cached until the view changes */
+	struct {
+		mwdTileBox						pos;
+		mwdTileBox						render;
+		bool							valid;
+	} geometry;
+
+	/* The output the view belongs to; tiled views are arranged on it */
+	struct mwdOutput					*output;
+
+	/* The tags the view is on, and if it is currently on a selected tag */
+	uint32_t							tags;
+	bool								visible;
+
+	/* Set when the view is scrolled off of its output, and if it is drawn */
+	bool								culled;
+	bool								drawn;
+
+	struct {
+		uint64_t						draw;
+		uint64_t						user;
+	} seq;
+
+	/* Set when the user has taken the view out of the tiling layout */
+	bool								floating;
+
+	struct {
+		struct mwdTransaction			*txn;
+		struct wl_list					link;
+
+		/* Set once the view has acked and committed its new state */
+		bool							ready;
+	} transaction;
+
+	/* The buffer and geometry rendered while a transaction is in flight */
+	struct {
+		struct wlr_client_buffer		*buffer;
+		double							top, left;
+		double							width, height;
+		enum wl_output_transform		transform;
+	} saved;
+
+	/* The result of the window rules for the app_id and title it was for */
+	struct {
+		char							*appId;
+		char							*title;
+		mwdRuleResult					result;
+
+		struct wl_listener				setTitle;
+		struct wl_listener				setAppId;
+	} rules;
+
+	/* Compiled keyboard remapping for this view's app_id, or NULL */
+	struct mwdRemapTable				*remap;
+
+	/* The view's slot in the store */
+	mwdViewHandle						handle;
 } mwdView;
 
+typedef struct mwdViewSlab
+{
+	mwdView								views[MWD_STORE_SLAB];
+} mwdViewSlab;
+
+typedef struct mwdTransaction
+{
+	mwdServer							*server;
+	struct wl_list						views;
+
+	/* The number of views that have not caught up yet */
+	int									waiting;
+
+	struct timespec						start;
+	struct wl_event_source				*timer;
+	bool								armed;
+} mwdTransaction;
+
+/*
+	Override-redirect X11 surfaces (menus, tooltips, drag icons) are not views;
+	they place themselves, can't be focused and aren't tiled.
+*/
+typedef struct mwdXWaylandUnmanaged
+{
+	struct wl_list						link;
+	mwdServer							*server;
+
+	struct wlr_xwayland_surface			*surface;
+
+	struct wl_listener					map;
+	struct wl_listener					unmap;
+	struct wl_listener					destroy;
+	struct wl_listener					requestConfigure;
+} mwdXWaylandUnmanaged;
+
 typedef struct mwdRenderData
 {
 	struct wlr_output		*output;
@@ -198,6 +853,9 @@ typedef struct mwdRenderData
 	mwdView					*view;
 
 	int						sx, sy;
+
+	/* Set while a transaction is in flight, to draw the view's saved buffer */
+	bool					saved;
 } mwdRenderData;
 
 typedef struct mwdKeyboard
@@ -209,8 +867,80 @@ typedef struct mwdKeyboard
 
 	struct wl_listener					modifiers;
 	struct wl_listener					key;
+
+	/* Keys that were remapped when pressed, so the release can match */
+	struct {
+		uint32_t						from;
+		uint32_t						to;
+	} remapped[WLR_KEYBOARD_KEYS_CAP];
 } mwdKeyboard;
 
+typedef struct mwdVirtual
+{
+	struct wl_list						link;
+	mwdServer							*server;
+	char								*name;
+
+	int									width, height;
+
+	/* In mHz, or 0 for the default */
+	int									refresh;
+
+	struct wlr_output					*output;
+	struct wl_listener					destroy;
+
+	/* Cleared while reading the file, to find the outputs that were removed */
+	bool								seen;
+} mwdVirtual;
+
+typedef struct mwdIdleInhibitor
+{
+	struct wl_list						link;
+	mwdServer							*server;
+
+	struct wlr_idle_inhibitor_v1		*inhibitor;
+	struct wl_listener					destroy;
+} mwdIdleInhibitor;
+
+typedef struct mwdPointerConstraint
+{
+	mwdServer							*server;
+
+	struct wlr_pointer_constraint_v1	*constraint;
+	struct wl_listener					destroy;
+} mwdPointerConstraint;
+
+typedef struct mwdRemapRule
+{
+	struct wl_list						link;
+	char								*appId;
+
+	struct {
+		uint32_t						mods;
+		xkb_keysym_t					sym;
+	} from, to;
+} mwdRemapRule;
+
+typedef struct mwdRemapTable
+{
+	struct wl_list						link;
+	char								*appId;
+
+	/* The number of rules for the app_id, and the keymap they were built for */
+	uint32_t							rules;
+	struct xkb_keymap					*keymap;
+
+	/* Open addressed hash table keyed by keycode and modifiers */
+	uint32_t							size;
+	uint32_t							count;
+	struct {
+		bool							used;
+		uint32_t						key;
+		uint32_t						keycode;
+		uint32_t						mods;
+	} *entries;
+} mwdRemapTable;
+
 typedef struct mwdViewInterface
 {
 	struct {
@@ -220,6 +950,8 @@ typedef struct mwdViewInterface
 
 	struct {
 		struct wlr_surface	*(*surface		)(mwdView *view);
+		const char			*(*appId		)(mwdView *view);
+		const char			*(*title		)(mwdView *view);
 		bool				(*constraints	)(mwdView *view, double *minWidth, double *maxWidth, double *minHeight, double *maxHeight);
 		void				(*pos			)(mwdView *view, double *top, double *right, double *bottom, double *left);
 		void				(*renderPos		)(mwdView *view, double *top, double *right, double *bottom, double *left);
@@ -230,61 +962,223 @@ typedef struct mwdViewInterface
 		bool				(*valid			)(mwdView *view);
 		bool				(*at			)(mwdView *view, double x, double y, struct wlr_surface **surface, double *offsetX, double *offsetY);
 		bool				(*visible		)(mwdView *view, mwdOutput *output);
+		bool				(*floating		)(mwdView *view);
+		bool				(*configured	)(mwdView *view);
+		bool				(*unbounded		)(mwdView *view);
 	} is;
 
 	struct {
 		void				(*surface		)(mwdView *view, wlr_surface_iterator_func_t iterator, void *user_data);
 	} foreach;
 
+    void					(*commit		)(mwdView *view);
+    void					(*flush			)(mwdView *view);
     void					(*destroy		)(mwdView *view);
     void					(*render		)(mwdView *view, struct wlr_renderer *renderer, mwdOutput *output);
 } mwdViewInterface;
 
 /* output.c */
 void OutputAdd(struct wl_listener *listener, void *data);
+bool OutputConfigApply(mwdServer *server, struct wlr_output_configuration_v1 *config);
 void OutputApplyCfg(struct wl_listener *listener, void *data);
 void OutputLayoutChanged(struct wl_listener *listener, void *data);
+void OutputSetPower(struct wl_listener *listener, void *data);
 void OutputTestCfg(struct wl_listener *listener, void *data);
 mwdOutput *OutputFind(mwdServer *server, struct wlr_output *output);
+mwdOutput *OutputAt(mwdServer *server, double x, double y);
+uint32_t OutputMask(mwdServer *server, mwdTileBox *box);
 void OutputTestApply(struct mwdOutputTest *test);
 void OutputTestRevert(struct mwdOutputTest *test);
 
+/* profile.c */
+void ProfileMain(mwdServer *server);
+bool ProfileSetPath(mwdServer *server, const char *path);
+void ProfileSave(mwdServer *server);
+mwdProfileOutput *ProfileForOutput(mwdServer *server, struct wlr_output *output);
+void ProfileStage(struct wlr_output *output, mwdProfileOutput *o);
+void ProfileOutputsChanged(mwdServer *server);
+
 /* render.c */
 void RenderFrame(struct wl_listener *listener, void *data);
 void RenderSurface(struct wlr_surface *surface, int sx, int sy, void *data);
 void RenderPopupSurface(struct wlr_surface *surface, int sx, int sy, void *data);
+void RenderSaved(mwdView *view, struct wlr_renderer *renderer, mwdOutput *output);
+void RenderOutputInit(mwdOutput *output);
+void RenderOutputDestroy(mwdOutput *output);
+
+/* compose.c */
+void ComposeMain(mwdServer *server);
+void ComposeStop(mwdServer *server);
+bool ComposeSetThreads(mwdServer *server, const char *threads);
+bool ComposeSurfaceLayer(struct wlr_surface *surface, struct wlr_box *box, mwdComposeLayer *layer);
+bool ComposePoolStart(mwdComposePool *pool, int threads);
+void ComposePoolStop(mwdComposePool *pool);
+void ComposeFrame(mwdComposePool *pool, uint32_t *dst, int width, int height, int stride,
+		uint32_t background, const mwdComposeLayer *layers, int count);
 
 /* input.c */
 void inputMain(mwdServer *server);
 
+/* virtual.c */
+void VirtualMain(mwdServer *server);
+bool VirtualSetPath(mwdServer *server, const char *path);
+bool VirtualIsConsumed(mwdOutput *output);
+
+/* idle.c */
+void IdleMain(mwdServer *server);
+bool IdleSetDownclock(mwdServer *server, const char *secs);
+void IdleActivity(mwdServer *server);
+bool IdleThrottleFrame(mwdOutput *output);
+void IdleOutputInit(mwdOutput *output);
+void IdleOutputDestroy(mwdOutput *output);
+void IdleUpdateInhibit(mwdServer *server);
+
+/* constraint.c */
+void ConstraintMain(mwdServer *server);
+void ConstraintFocus(mwdServer *server, struct wlr_surface *surface);
+bool ConstraintIsLocked(mwdServer *server);
+bool ConstraintMotion(mwdServer *server, uint32_t time, double *dx, double *dy, double unaccelX, double unaccelY);
+
+/* remap.c */
+void RemapMain(mwdServer *server);
+bool RemapAddRule(mwdServer *server, const char *rule);
+mwdRemapTable *RemapFind(mwdServer *server, const char *appId);
+void RemapFocus(mwdServer *server, struct wlr_surface *surface);
+bool RemapKeyPress(mwdKeyboard *keyboard, uint32_t time, uint32_t keycode, uint32_t modifiers);
+bool RemapKeyRelease(mwdKeyboard *keyboard, uint32_t time, uint32_t keycode);
+
+/* rules.c */
+void RulesMain(mwdServer *server);
+bool RulesAdd(mwdServer *server, const char *rule);
+bool RulesCompile(mwdServer *server);
+bool RulesEvaluate(mwdView *view);
+void RulesViewInit(mwdView *view);
+void RulesViewDestroy(mwdView *view);
+
+/* stats.c */
+void StatsMain(mwdServer *server);
+void StatsDump(mwdServer *server);
+uint64_t StatsElapsed(struct timespec *start, struct timespec *end);
+void HistogramInit(mwdHistogram *hist, const char *name);
+void HistogramAdd(mwdHistogram *hist, uint64_t usec);
+void HistogramDump(mwdHistogram *hist, const char *prefix);
+
+/* latency.c */
+void LatencyOutputInit(mwdOutput *output);
+void LatencyInput(mwdView *view, uint32_t time);
+void LatencyCommit(mwdView *view);
+void LatencyRender(mwdView *view, mwdOutput *output);
+void LatencyFrameCommitted(mwdOutput *output);
+
+/* record.c */
+bool RecordStart(mwdServer *server, const char *path);
+void RecordStop(mwdServer *server);
+void RecordMotion(mwdServer *server, struct wlr_event_pointer_motion *e);
+void RecordMotionAbsolute(mwdServer *server, struct wlr_event_pointer_motion_absolute *e);
+void RecordButton(mwdServer *server, struct wlr_event_pointer_button *e);
+void RecordAxis(mwdServer *server, struct wlr_event_pointer_axis *e);
+void RecordFrame(mwdServer *server);
+void RecordKey(mwdServer *server, struct wlr_event_keyboard_key *e);
+bool ReplayOpen(mwdServer *server, const char *path);
+bool ReplayStart(mwdServer *server);
+void ReplayStop(mwdServer *server);
+
+/* tile.c */
+void TileOutputInit(mwdOutput *output);
+bool TileIsTiled(mwdView *view);
+void TileArrange(mwdOutput *output);
+void TileMarkDirty(mwdOutput *output);
+void TileMarkTagsDirty(mwdOutput *output, uint32_t tags);
+void TileMarkAllDirty(mwdServer *server);
+void TileSetKind(mwdOutput *output, mwdTileKind kind);
+void TileAdjustRatio(mwdOutput *output, double delta);
+void TileAdjustCount(mwdOutput *output, int delta);
+void TileScroll(mwdOutput *output, double delta);
+void TileReveal(mwdView *view);
+
+/* tag.c */
+void TagMain(mwdServer *server);
+void TagOutputInit(mwdOutput *output);
+void TagViewInit(mwdView *view);
+void TagLink(mwdView *view);
+void TagUnlink(mwdView *view);
+void TagRaise(mwdView *view);
+void TagSetOutput(mwdView *view, mwdOutput *output);
+void TagSetView(mwdView *view, uint32_t tags);
+void TagToggleView(mwdView *view, uint32_t tags);
+void TagSelect(mwdOutput *output, uint32_t tags);
+void TagToggle(mwdOutput *output, uint32_t tags);
+void TagSelectPrevious(mwdOutput *output);
+void TagFrameCommitted(mwdOutput *output);
+void TagSetCulled(mwdView *view, bool culled);
+
+/* generator.c */
+void GeneratorMain(mwdServer *server);
+bool GeneratorStart(mwdServer *server, const char *command);
+void GeneratorStop(mwdServer *server);
+mwdGeneratorResult GeneratorLayout(mwdOutput *output, mwdTileBox *area, int count, mwdTileBox *boxes);
+
+/* transaction.c */
+void TransactionMain(mwdServer *server);
+mwdTransaction *TransactionBegin(mwdServer *server);
+void TransactionSetPos(mwdTransaction *txn, mwdView *view, double top, double right, double bottom, double left);
+void TransactionCommit(mwdTransaction *txn);
+void TransactionViewCommitted(mwdView *view);
+void TransactionRemoveView(mwdView *view);
+
+/* store.c */
+void StoreMain(mwdServer *server);
+void StoreFinish(mwdServer *server);
+mwdView *StoreAlloc(mwdServer *server);
+void StoreFree(mwdView *view);
+mwdView *StoreView(mwdServer *server, mwdViewHandle handle);
+mwdViewHot *StoreHot(mwdView *view);
+
 /* view.c */
 void RenderView(mwdView *view, struct wlr_renderer *renderer, mwdOutput *output);
 mwdView *CreateNewView(mwdServer *server);
 bool ViewIsValid(mwdView *view);
 bool ViewIsVisible(mwdView *view, mwdOutput *output);
+bool ViewIsConfigured(mwdView *view);
+bool ViewIsUnbounded(mwdView *view);
 struct wlr_surface *ViewGetSurface(mwdView *view);
+const char *ViewGetAppId(mwdView *view);
+const char *ViewGetTitle(mwdView *view);
 bool ViewIsFocused(mwdView *view);
 void ViewFocus(mwdView *view, bool raise);
 mwdView *ViewFocused(mwdServer *server);
 mwdView *ViewNext(mwdView *view);
 mwdView *ViewPrev(mwdView *view);
 void ViewGrab(mwdView *view, mwdGrabMode mode, uint32_t edges);
+bool ViewGrabMotion(mwdServer *server);
 
 mwdView *ViewFindByPos(mwdServer *server, double x, double y, struct wlr_surface **psurface, double *offsetX, double *offsetY);
 mwdView *ViewFindBySurface(mwdServer *server, struct wlr_surface *surface);
 void ViewSetActivated(mwdView *view, bool activated);
 bool ViewGetConstraints(mwdView *view, double *minWidth, double *maxWidth, double *minHeight, double *maxHeight);
 void ViewSetPos(mwdView *view, double top, double right, double bottom, double left);
+void ViewFlush(mwdView *view);
 void ViewGetPos(mwdView *view, double *top, double *right, double *bottom, double *left);
 void ViewGetRenderPos(mwdView *view, double *top, double *right, double *bottom, double *left);
 void ViewGetSize(mwdView *view, double *width, double *height);
+void ViewSetEdges(mwdView *view, uint32_t edges);
+void ViewGeometryChanged(mwdView *view);
+void ViewSyncStore(mwdView *view);
+void ViewSyncStoreAll(mwdServer *server);
 
 void ViewForEachSurface(mwdView *view, wlr_surface_iterator_func_t iterator, void *user_data);
+void ViewSendFrameDone(mwdView *view);
 
 /* shell_*.c */
 void XdgMain(mwdServer *server);
 void LayerMain(mwdServer *server);
+void LayerArrange(mwdOutput *output);
 void XWaylandMain(mwdServer *server);
+void XWaylandStop(mwdServer *server);
+bool XWaylandSetPolicy(mwdServer *server, const char *policy);
+void XWaylandFlushConfigures(mwdServer *server);
+void XWaylandRenderUnmanaged(mwdOutput *output, struct wlr_renderer *renderer);
+struct wlr_surface *XWaylandUnmanagedAt(mwdServer *server, double x, double y, double *offsetX, double *offsetY);
 
 #endif // _MWD_H
 
@@ -13,53 +13,81 @@ mwdOutput *OutputFind(mwdServer *server, struct wlr_output *output)
 	return NULL;
 }
 
-#define TEST_TIMEOUT_SECS 15
-static int OutputConfigTestTimeout(void *data)
+/* Return the output at the specified layout coordinates, or the first output */
+mwdOutput *OutputAt(mwdServer *server, double x, double y)
 {
-	OutputTestRevert((mwdOutputTest *) data);
-	return 0;
+	struct wlr_output	*o;
+	mwdOutput			*output;
+
+	if ((o = wlr_output_layout_output_at(server->layout, x, y)) &&
+		(output = OutputFind(server, o)) && output->powered
+	) {
+		return output;
+	}
+
+	/* Prefer an output that is powered on */
+	wl_list_for_each(output, &server->outputs, link) {
+		if (output->powered) {
+			return output;
+		}
+	}
+	return OutputFind(server, NULL);
 }
 
-/* Commit the provided configuration to the active outputs */
-void OutputConfigApply(mwdServer *server, struct wlr_output_configuration_v1 *config)
+/*
+	Track if the output is powered on. An output that is off isn't rendered,
+	so the views that are only on it get no frame callbacks, and it is skipped
+	when hit-testing and arranging.
+*/
+static void OutputSetPowered(mwdOutput *output, bool powered)
 {
-	struct wlr_output_configuration_head_v1		*head;
-	struct wlr_output							*o;
+	mwdServer			*server = output->server;
 
-	/* Prevent sending events to the clients until we are done */
-	server->output.applying = true;
+	if (output->powered == powered) {
+		return;
+	}
+	output->powered = powered;
 
-	wl_list_for_each(head, &config->heads, link) {
-		o = head->state.output;
+	if (powered) {
+		server->output.powered |= output->mask;
 
-		if (head->state.enabled && !o->enabled) {
-			wlr_output_layout_add_auto(server->layout, o);
-		} else if (!head->state.enabled && o->enabled) {
-			wlr_output_layout_remove(server->layout, o);
-		}
+		/* Nothing was drawn while it was off, so arrange and repaint all of it */
+		TileMarkDirty(output);
+		wlr_output_schedule_frame(output->output);
+	} else {
+		server->output.powered &= ~output->mask;
 
-		wlr_output_enable(o, head->state.enabled);
+		/* This may have been the frame the held back X11 configures waited for */
+		XWaylandFlushConfigures(server);
+	}
+}
 
-		/* All other settings only have an effect if the output is enabled. */
-		if (head->state.enabled) {
-			if (head->state.mode) {
-				wlr_output_set_mode(o, head->state.mode);
-			} else {
-				wlr_output_set_custom_mode(o,
-						head->state.custom_mode.width, head->state.custom_mode.height,
-						head->state.custom_mode.refresh);
-			}
+/* Return the mask of the outputs that overlap a box in layout coordinates */
+uint32_t OutputMask(mwdServer *server, mwdTileBox *box)
+{
+	mwdOutput			*output;
+	struct wlr_box		*o;
+	uint32_t			mask = 0;
 
-			wlr_output_layout_move(server->layout, o, head->state.x, head->state.y);
+	wl_list_for_each(output, &server->outputs, link) {
+		if (!(o = wlr_output_layout_get_box(server->layout, output->output))) {
+			continue;
+		}
 
-			wlr_output_set_scale(o, head->state.scale);
-			wlr_output_set_transform(o, head->state.transform);
+		if (box->left < o->x + o->width && box->right > o->x &&
+			box->top < o->y + o->height && box->bottom > o->y
+		) {
+			mask |= output->mask;
 		}
-		wlr_output_commit(o);
 	}
+	return mask;
+}
 
-	/* Allow output change events to resume */
-	server->output.applying = false;
+#define TEST_TIMEOUT_SECS 15
+static int OutputConfigTestTimeout(void *data)
+{
+	OutputTestRevert((mwdOutputTest *) data);
+	return 0;
 }
 
 /*
@@ -87,10 +115,228 @@ static struct wlr_output_configuration_v1 *OutputConfigCreate(mwdServer *server)
 			head->state.x = box->x;
 			head->state.y = box->y;
 		}
+
+		/* An output that is powered off is still part of the configuration */
+		if (!output->powered) {
+			head->state.enabled = true;
+		}
 	}
 	return config;
 }
 
+/*
+	Layout changes
+
+	Hotplugging a dock can change the layout many times in a row, so the work
+	that depends on the layout is done once per event loop iteration (when it
+	is idle) no matter how many changes there were. Clients are told about the
+	new configuration at most once per OUTPUT_NOTIFY_MSEC, since that means
+	building and sending a full configuration to every output manager client.
+*/
+#define OUTPUT_NOTIFY_MSEC		100
+
+/* Give all connected clients a new configuration object */
+static int OutputLayoutNotify(void *data)
+{
+	mwdServer							*server = data;
+	struct wlr_output_configuration_v1	*config;
+
+	server->output.layout.notifyPending = false;
+	server->output.layout.notifies++;
+
+	if ((config = OutputConfigCreate(server))) {
+		/* the set_configuration() call will destroy the configuration object for us */
+		wlr_output_manager_v1_set_configuration(server->output.mgr, config);
+	}
+	return 0;
+}
+
+/* Update everything that depends on the layout */
+static void OutputLayoutUpdate(void *data)
+{
+	mwdServer							*server = data;
+	struct wl_event_loop				*loop	= wl_display_get_event_loop(server->display);
+	mwdOutput							*output;
+
+	server->output.layout.idle = NULL;
+	server->output.layout.updates++;
+
+	/* Outputs may have moved or changed size */
+	wl_list_for_each(output, &server->outputs, link) {
+		LayerArrange(output);
+	}
+	TileMarkAllDirty(server);
+	ViewSyncStoreAll(server);
+
+	if (server->output.layout.notifyPending) {
+		return;
+	}
+
+	if (!server->output.layout.notify) {
+		server->output.layout.notify = wl_event_loop_add_timer(loop, OutputLayoutNotify, server);
+	}
+
+	if (!server->output.layout.notify ||
+		wl_event_source_timer_update(server->output.layout.notify, OUTPUT_NOTIFY_MSEC)
+	) {
+		OutputLayoutNotify(server);
+		return;
+	}
+	server->output.layout.notifyPending = true;
+}
+
+static void OutputLayoutSchedule(mwdServer *server)
+{
+	struct wl_event_loop				*loop	= wl_display_get_event_loop(server->display);
+
+	server->output.layout.changes++;
+
+	if (!server->output.layout.idle &&
+		!(server->output.layout.idle = wl_event_loop_add_idle(loop, OutputLayoutUpdate, server))
+	) {
+		OutputLayoutUpdate(server);
+	}
+}
+
+/* Drop the pending state of every output in the configuration */
+static void OutputConfigRollback(struct wlr_output_configuration_v1 *config)
+{
+	struct wlr_output_configuration_head_v1		*head;
+
+	wl_list_for_each(head, &config->heads, link) {
+		wlr_output_rollback(head->state.output);
+	}
+}
+
+/*
+	Set the state of each head as the pending state of its output, and check
+	with a test-only commit that every output will accept it. Nothing has been
+	changed if this fails.
+*/
+static bool OutputConfigStage(struct wlr_output_configuration_v1 *config)
+{
+	struct wlr_output_configuration_head_v1		*head;
+	struct wlr_output							*o;
+
+	wl_list_for_each(head, &config->heads, link) {
+		o = head->state.output;
+
+		wlr_output_enable(o, head->state.enabled);
+
+		/* All other settings only have an effect if the output is enabled. */
+		if (head->state.enabled) {
+			if (head->state.mode) {
+				wlr_output_set_mode(o, head->state.mode);
+			} else {
+				wlr_output_set_custom_mode(o,
+						head->state.custom_mode.width, head->state.custom_mode.height,
+						head->state.custom_mode.refresh);
+			}
+
+			wlr_output_set_scale(o, head->state.scale);
+			wlr_output_set_transform(o, head->state.transform);
+		}
+	}
+
+	wl_list_for_each(head, &config->heads, link) {
+		if (!wlr_output_test(head->state.output)) {
+			wlr_log(WLR_ERROR, "Output %s rejected the configuration", head->state.output->name);
+			OutputConfigRollback(config);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Commit the staged state of each output; stops at the first that fails */
+static bool OutputConfigCommit(struct wlr_output_configuration_v1 *config)
+{
+	struct wlr_output_configuration_head_v1		*head;
+
+	wl_list_for_each(head, &config->heads, link) {
+		if (!wlr_output_commit(head->state.output)) {
+			wlr_log(WLR_ERROR, "Failed to commit the configuration of output %s", head->state.output->name);
+			OutputConfigRollback(config);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+	Apply a configuration to the outputs as a whole. Every output is tested
+	before any of them are changed, and if a commit still fails the outputs
+	that were already changed are put back the way they were, so either the
+	whole configuration is applied or none of it is.
+
+	The layout is only updated once all of the outputs have been committed,
+	and clients are told about the result once.
+*/
+bool OutputConfigApply(mwdServer *server, struct wlr_output_configuration_v1 *config)
+{
+	struct wlr_output_configuration_head_v1		*head;
+	struct wlr_output_configuration_v1			*previous;
+	mwdOutput									*output;
+	bool										applied	= false;
+
+	/* Prevent sending events to the clients until we are done */
+	server->output.applying = true;
+
+	previous = OutputConfigCreate(server);
+
+	if (!OutputConfigStage(config)) {
+		goto done;
+	}
+
+	if (!OutputConfigCommit(config)) {
+		if (previous && OutputConfigStage(previous)) {
+			OutputConfigCommit(previous);
+		}
+		goto done;
+	}
+
+	wl_list_for_each(head, &config->heads, link) {
+		/*
+			The mode that was committed replaces the one an idle downclock
+			would have restored, and a throttled output draws normally again.
+		*/
+		if ((output = OutputFind(server, head->state.output))) {
+			output->idle.mode = NULL;
+
+			if (output->idle.throttled) {
+				output->idle.throttled = false;
+				wlr_output_schedule_frame(output->output);
+			}
+		}
+
+		if (head->state.enabled) {
+			/* Adds the output, or moves it if it is already in the layout */
+			wlr_output_layout_add(server->layout, head->state.output, head->state.x, head->state.y);
+
+			/* Enabling an output that was powered off also powers it on */
+			if (output) {
+				OutputSetPowered(output, true);
+			}
+		} else {
+			wlr_output_layout_remove(server->layout, head->state.output);
+		}
+	}
+	applied = true;
+
+done:
+	if (previous) {
+		wlr_output_configuration_v1_destroy(previous);
+	}
+
+	/* Allow output change events to resume */
+	server->output.applying = false;
+
+	if (applied) {
+		OutputLayoutSchedule(server);
+	}
+	return applied;
+}
+
 static void OutputTestFree(mwdOutputTest *test)
 {
 	if (test) {
@@ -116,6 +362,7 @@ static void OutputTestFree(mwdOutputTest *test)
 
 void OutputTestApply(mwdOutputTest *test)
 {
+	ProfileSave(test->server);
 	OutputTestFree(test);
 }
 
@@ -130,18 +377,13 @@ void OutputTestRevert(mwdOutputTest *test)
 void OutputLayoutChanged(struct wl_listener *listener, void *data)
 {
 	mwdServer							*server = wl_container_of(listener, server, layoutChanged);
-	struct wlr_output_configuration_v1	*config;
 
 	if (server->output.applying) {
 		/* A change event for all the pending changes will be sent when they are complete */
 		return;
 	}
 
-	/* Give all connected clients a new configuration object */
-	if ((config = OutputConfigCreate(server))) {
-		/* the set_configuration() call will destroy the configuration object for us */
-		wlr_output_manager_v1_set_configuration(server->output.mgr, config);
-	}
+	OutputLayoutSchedule(server);
 }
 
 /* A client has requested that a permanent change be applied to the output configuration */
@@ -150,9 +392,12 @@ void OutputApplyCfg(struct wl_listener *listener, void *data)
 	mwdServer							*server		= wl_container_of(listener, server, output.apply);
 	struct wlr_output_configuration_v1	*config		= data;
 
-	OutputConfigApply(server, config);
-
-	wlr_output_configuration_v1_send_succeeded(config);
+	if (OutputConfigApply(server, config)) {
+		ProfileSave(server);
+		wlr_output_configuration_v1_send_succeeded(config);
+	} else {
+		wlr_output_configuration_v1_send_failed(config);
+	}
 	wlr_output_configuration_v1_destroy(config);
 }
 
@@ -200,10 +445,12 @@ void OutputTestCfg(struct wl_listener *listener, void *data)
 		goto failure;
 	}
 
-	server->output.pendingTest = test;
-
 	/* Now apply the new configuration so the user can see the result. */
-	OutputConfigApply(server, test->newConfig);
+	if (!OutputConfigApply(server, test->newConfig)) {
+		goto failure;
+	}
+
+	server->output.pendingTest = test;
 	return;
 
 failure:
@@ -211,18 +458,94 @@ failure:
 	OutputTestFree(test);
 }
 
+/* A client has asked for an output to be powered on or off */
+void OutputSetPower(struct wl_listener *listener, void *data)
+{
+	mwdServer									*server	= wl_container_of(listener, server, output.setPower);
+	struct wlr_output_power_v1_set_mode_event	*event	= data;
+	mwdOutput									*output;
+	bool										on		= event->mode == ZWLR_OUTPUT_POWER_V1_MODE_ON;
+
+	if (!(output = OutputFind(server, event->output)) || output->powered == on) {
+		return;
+	}
+
+	wlr_output_enable(event->output, on);
+	if (!wlr_output_commit(event->output)) {
+		wlr_log(WLR_ERROR, "Failed to power %s output %s", on ? "on" : "off", event->output->name);
+		return;
+	}
+
+	OutputSetPowered(output, on);
+}
+
+static void OutputDestroy(struct wl_listener *listener, void *data)
+{
+	mwdOutput				*output		= wl_container_of(listener, output, destroy);
+	mwdServer				*server		= output->server;
+	mwdOutput				*other;
+	mwdView					*view;
+
+	wl_list_remove(&output->link);
+	wl_list_remove(&output->frame.link);
+	wl_list_remove(&output->destroy.link);
+	wl_list_remove(&output->latency.present.link);
+	IdleOutputDestroy(output);
+	RenderOutputDestroy(output);
+	server->output.masks &= ~output->mask;
+	server->output.powered &= ~output->mask;
+
+	/* Move any views that were on this output to another output */
+	other = OutputFind(server, NULL);
+
+	wl_list_for_each(view, &server->views.drawOrder, link.drawOrder) {
+		if (view->output != output) {
+			continue;
+		}
+
+		if (view->type == MWD_LAYER_SHELL) {
+			/*
+				A layer surface belongs to its output, and its exclusive zone
+				means nothing on another one, so it is closed instead.
+			*/
+			view->layer.surface->output = NULL;
+			wlr_layer_surface_v1_close(view->layer.surface);
+			TagSetOutput(view, NULL);
+		} else {
+			TagSetOutput(view, other);
+		}
+	}
+
+	free(output);
+
+	/* The remaining monitors may have a profile of their own */
+	ProfileOutputsChanged(server);
+}
+
 void OutputAdd(struct wl_listener *listener, void *data)
 {
 	mwdServer				*server		= wl_container_of(listener, server, output.added);
 	struct wlr_output		*wlr_output	= data;
 	struct wlr_output_mode	*mode;
 	mwdOutput				*output;
+	mwdProfileOutput		*profile	= NULL;
 
 	/*
-		Depending on the backend there may or may not be modes. If there are
+		If this monitor has been configured before then use that for the first
+		commit, so it doesn't have to be changed again right away. Otherwise,
+		depending on the backend there may or may not be modes. If there are
 		then attempt to select the "preferred" one for now.
 	*/
-	if (!wl_list_empty(&wlr_output->modes)) {
+	if (!server->virtuals.adding && (profile = ProfileForOutput(server, wlr_output))) {
+		ProfileStage(wlr_output, profile);
+
+		if (!wlr_output_commit(wlr_output)) {
+			wlr_log(WLR_ERROR, "Output %s rejected its saved configuration", wlr_output->name);
+			profile = NULL;
+		}
+	}
+
+	if (!profile && !wl_list_empty(&wlr_output->modes)) {
 		mode = wlr_output_preferred_mode(wlr_output);
 
 		wlr_output_set_mode(wlr_output, mode);
@@ -239,14 +562,45 @@ void OutputAdd(struct wl_listener *listener, void *data)
 	}
 	output->output		= wlr_output;
 	output->server		= server;
+	output->powered		= true;
+	output->isVirtual	= server->virtuals.adding;
+
+	/*
+		Each output gets a bit, so the store can record which outputs a view
+		overlaps. Any past the first 32 get none, and draw every view.
+	*/
+	for (int i = 0; i < 32; i++) {
+		if (!(server->output.masks & (1u << i))) {
+			output->mask			= 1u << i;
+			server->output.masks	|= output->mask;
+			server->output.powered	|= output->mask;
+			break;
+		}
+	}
 
 	/* Sets up a listener for the frame notify event */
 	output->frame.notify = RenderFrame;
 	wl_signal_add(&wlr_output->events.frame, &output->frame);
 
+	output->destroy.notify = OutputDestroy;
+	wl_signal_add(&wlr_output->events.destroy, &output->destroy);
+
+	LatencyOutputInit(output);
+	IdleOutputInit(output);
+	RenderOutputInit(output);
+
 	wl_list_insert(&server->outputs, &output->link);
 
-	wlr_output_layout_add_auto(server->layout, wlr_output);
+	if (!profile) {
+		wlr_output_layout_add_auto(server->layout, wlr_output);
+	} else if (profile->enabled) {
+		wlr_output_layout_add(server->layout, wlr_output, profile->x, profile->y);
+	}
+	TileOutputInit(output);
+	TagOutputInit(output);
+
+	/* The other outputs may need to move to match the profile */
+	ProfileOutputsChanged(server);
 }
 
 
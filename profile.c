@@ -0,0 +1,570 @@
+#include "../mwd.h"
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/*
+	Output profiles
+
+	Every time a configuration is applied by a client (ie wlr-randr) it is
+	remembered as a profile for the set of monitors that are connected, and
+	each monitor is identified by its make, model and serial so that it is
+	recognized no matter which connector it is plugged into.
+
+	When an output is added its first commit already uses the mode, scale and
+	transform from the profile for the monitors that are now connected, so the
+	usual preferred mode modeset followed by a second one from the rc script
+	doesn't happen. If there is no profile for that exact set then the most
+	recently saved profile that has the monitor is used for its first commit.
+	Once the outputs settle (on idle) the other outputs are moved and
+	configured to match the profile, if they don't already.
+
+	The profiles are stored in $XDG_CONFIG_HOME/mwd/outputs, or the file given
+	with -o, most recent first:
+
+		profile
+			output <enabled> <width> <height> <refresh> <x> <y> <scale> <transform> "<identity>"
+
+	The identity is everything between the first and the last quote, exactly,
+	since the make or model may be empty or have spaces of their own.
+*/
+
+#define PROFILE_LINE_MAX		512
+
+/*
+	The identity of a monitor is its make, model and serial. Plenty of monitors
+	have no serial (or report 0), so two of the same model can only be told
+	apart by the connector they are on.
+*/
+static void ProfileIdentity(struct wlr_output *output, char *buf, size_t size)
+{
+	const char		*serial = output->serial;
+
+	if (!*serial || !strcmp(serial, "0") || !strcmp(serial, "Unknown")) {
+		snprintf(buf, size, "%s %s on %s", output->make, output->model, output->name);
+	} else {
+		snprintf(buf, size, "%s %s %s", output->make, output->model, serial);
+	}
+}
+
+static int ProfileCompare(const void *a, const void *b)
+{
+	return strcmp(*(const char **) a, *(const char **) b);
+}
+
+/*
+	Build the key for a set of monitors; their sorted identities, one per line.
+	The extra output is included if it isn't in the list of outputs yet.
+*/
+static char *ProfileKey(mwdServer *server, struct wlr_output *extra)
+{
+	mwdOutput		*output;
+	char			**identities;
+	char			*key		= NULL;
+	size_t			len			= 1;
+	int				count		= 0;
+	int				max			= wl_list_length(&server->outputs) + 1;
+
+	if (!(identities = calloc(max, sizeof(char *)))) {
+		return NULL;
+	}
+
+	wl_list_for_each(output, &server->outputs, link) {
+		if (output->output == extra) {
+			extra = NULL;
+		}
+
+		/* Virtual outputs have no identity of their own, and have their own config */
+		if (output->isVirtual) {
+			continue;
+		}
+
+		if (!(identities[count] = calloc(1, PROFILE_LINE_MAX))) {
+			goto done;
+		}
+		ProfileIdentity(output->output, identities[count], PROFILE_LINE_MAX);
+		len += strlen(identities[count++]) + 1;
+	}
+
+	if (extra) {
+		if (!(identities[count] = calloc(1, PROFILE_LINE_MAX))) {
+			goto done;
+		}
+		ProfileIdentity(extra, identities[count], PROFILE_LINE_MAX);
+		len += strlen(identities[count++]) + 1;
+	}
+
+	qsort(identities, count, sizeof(char *), ProfileCompare);
+
+	if (!(key = calloc(1, len))) {
+		goto done;
+	}
+
+	for (int i = 0; i < count; i++) {
+		strcat(key, identities[i]);
+		strcat(key, "\n");
+	}
+
+done:
+	for (int i = 0; i < max; i++) {
+		free(identities[i]);
+	}
+	free(identities);
+	return key;
+}
+
+static void ProfileFree(mwdProfile *profile)
+{
+	if (!profile) {
+		return;
+	}
+
+	for (int i = 0; i < profile->count; i++) {
+		free(profile->outputs[i].identity);
+	}
+	free(profile->outputs);
+	free(profile->key);
+	free(profile);
+}
+
+static mwdProfile *ProfileFind(mwdServer *server, const char *key)
+{
+	mwdProfile		*profile;
+
+	wl_list_for_each(profile, &server->profiles.list, link) {
+		if (!strcmp(profile->key, key)) {
+			return profile;
+		}
+	}
+	return NULL;
+}
+
+static mwdProfileOutput *ProfileFindOutput(mwdProfile *profile, const char *identity)
+{
+	for (int i = 0; i < profile->count; i++) {
+		if (!strcmp(profile->outputs[i].identity, identity)) {
+			return &profile->outputs[i];
+		}
+	}
+	return NULL;
+}
+
+/* Rebuild the key of a profile that was loaded, from its outputs */
+static bool ProfileSetKey(mwdProfile *profile)
+{
+	char			**identities;
+	size_t			len = 1;
+
+	if (!(identities = calloc(profile->count + 1, sizeof(char *)))) {
+		return false;
+	}
+
+	for (int i = 0; i < profile->count; i++) {
+		identities[i] = profile->outputs[i].identity;
+		len += strlen(identities[i]) + 1;
+	}
+	qsort(identities, profile->count, sizeof(char *), ProfileCompare);
+
+	if ((profile->key = calloc(1, len))) {
+		for (int i = 0; i < profile->count; i++) {
+			strcat(profile->key, identities[i]);
+			strcat(profile->key, "\n");
+		}
+	}
+
+	free(identities);
+	return profile->key != NULL;
+}
+
+static mwdProfileOutput *ProfileAddOutput(mwdProfile *profile)
+{
+	mwdProfileOutput	*outputs;
+
+	if (!(outputs = realloc(profile->outputs, (profile->count + 1) * sizeof(mwdProfileOutput)))) {
+		return NULL;
+	}
+	profile->outputs = outputs;
+
+	memset(&outputs[profile->count], 0, sizeof(mwdProfileOutput));
+	return &outputs[profile->count++];
+}
+
+/* Finish a profile that was being loaded, and add it to the end of the list */
+static void ProfileLoaded(mwdServer *server, mwdProfile *profile)
+{
+	if (!profile) {
+		return;
+	}
+
+	if (!profile->count || !ProfileSetKey(profile) || ProfileFind(server, profile->key)) {
+		ProfileFree(profile);
+		return;
+	}
+	wl_list_insert(server->profiles.list.prev, &profile->link);
+}
+
+static void ProfileLoad(mwdServer *server)
+{
+	FILE				*file;
+	char				line[PROFILE_LINE_MAX];
+	char				*p;
+	mwdProfile			*profile	= NULL;
+	mwdProfileOutput	*o;
+	int					enabled, transform, n;
+	char				*identity, *end;
+
+	if (!server->profiles.path || !(file = fopen(server->profiles.path, "r"))) {
+		return;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		line[strcspn(line, "\n")] = '\0';
+
+		for (p = line; *p == ' ' || *p == '\t'; p++);
+
+		if (!strcmp(p, "profile")) {
+			ProfileLoaded(server, profile);
+
+			if (!(profile = calloc(1, sizeof(mwdProfile)))) {
+				break;
+			}
+			continue;
+		}
+
+		if (!profile || strncmp(p, "output ", 7) || !(o = ProfileAddOutput(profile))) {
+			continue;
+		}
+
+		/* Only the single space before the identity is skipped */
+		if (8 != sscanf(p + 7, "%d %d %d %d %d %d %f %d%n",
+				&enabled, &o->width, &o->height, &o->refresh, &o->x, &o->y,
+				&o->scale, &transform, &n) || p[7 + n] != ' ' ||
+			*(identity = p + 7 + n + 1) != '"' || (end = strrchr(identity, '"')) == identity
+		) {
+			wlr_log(WLR_ERROR, "Ignoring invalid output in %s: %s", server->profiles.path, p);
+			profile->count--;
+			continue;
+		}
+
+		o->enabled		= enabled;
+		o->transform	= transform;
+
+		if (!(o->identity = strndup(identity + 1, end - identity - 1))) {
+			profile->count--;
+		}
+	}
+	ProfileLoaded(server, profile);
+
+	fclose(file);
+}
+
+/* Write all of the profiles, replacing the file only once it is complete */
+static void ProfileWrite(mwdServer *server)
+{
+	FILE				*file;
+	mwdProfile			*profile;
+	mwdProfileOutput	*o;
+	char				tmp[PATH_MAX];
+	char				*slash;
+
+	if (!server->profiles.path) {
+		return;
+	}
+
+	/* Make sure the directory exists, ie on the first run */
+	snprintf(tmp, sizeof(tmp), "%s", server->profiles.path);
+	if ((slash = strrchr(tmp, '/')) && slash != tmp) {
+		*slash = '\0';
+		if (mkdir(tmp, 0755) && errno != EEXIST) {
+			wlr_log_errno(WLR_ERROR, "Failed to create %s", tmp);
+			return;
+		}
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", server->profiles.path);
+	if (!(file = fopen(tmp, "w"))) {
+		wlr_log_errno(WLR_ERROR, "Failed to open %s", tmp);
+		return;
+	}
+
+	wl_list_for_each(profile, &server->profiles.list, link) {
+		fprintf(file, "profile\n");
+
+		for (int i = 0; i < profile->count; i++) {
+			o = &profile->outputs[i];
+
+			fprintf(file, "\toutput %d %d %d %d %d %d %f %d \"%s\"\n",
+					o->enabled, o->width, o->height, o->refresh, o->x, o->y,
+					o->scale, (int) o->transform, o->identity);
+		}
+	}
+
+	if (fclose(file) || rename(tmp, server->profiles.path)) {
+		wlr_log_errno(WLR_ERROR, "Failed to write %s", server->profiles.path);
+		unlink(tmp);
+	}
+}
+
+/* Remember the current configuration as the profile for the connected monitors */
+void ProfileSave(mwdServer *server)
+{
+	mwdProfile			*profile;
+	mwdProfile			*old;
+	mwdProfileOutput	*o;
+	mwdOutput			*output;
+	struct wlr_box		*box;
+	char				identity[PROFILE_LINE_MAX];
+
+	if (!(profile = calloc(1, sizeof(mwdProfile)))) {
+		return;
+	}
+
+	if (!(profile->key = ProfileKey(server, NULL))) {
+		goto failure;
+	}
+
+	wl_list_for_each(output, &server->outputs, link) {
+		if (output->isVirtual) {
+			continue;
+		}
+
+		if (!(o = ProfileAddOutput(profile))) {
+			goto failure;
+		}
+
+		ProfileIdentity(output->output, identity, sizeof(identity));
+		if (!(o->identity = strdup(identity))) {
+			goto failure;
+		}
+
+		o->enabled		= output->output->enabled || !output->powered;
+		o->width		= output->output->width;
+		o->height		= output->output->height;
+		o->refresh		= output->output->refresh;
+		o->scale		= output->output->scale;
+		o->transform	= output->output->transform;
+
+		if ((box = wlr_output_layout_get_box(server->layout, output->output))) {
+			o->x		= box->x;
+			o->y		= box->y;
+		}
+	}
+
+	if (!profile->count) {
+		/* Only virtual outputs are connected */
+		ProfileFree(profile);
+		return;
+	}
+
+	/* The new profile replaces any old one for the same monitors, at the front */
+	if ((old = ProfileFind(server, profile->key))) {
+		wl_list_remove(&old->link);
+		ProfileFree(old);
+	}
+	wl_list_insert(&server->profiles.list, &profile->link);
+
+	ProfileWrite(server);
+	return;
+
+failure:
+	wlr_log(WLR_ERROR, "Failed to save the output profile");
+	ProfileFree(profile);
+}
+
+/*
+	Find the saved state for an output that is being added. The profile for
+	the monitors that will be connected is preferred, otherwise the most
+	recent profile that has this monitor.
+*/
+mwdProfileOutput *ProfileForOutput(mwdServer *server, struct wlr_output *output)
+{
+	mwdProfile			*profile;
+	mwdProfileOutput	*o;
+	char				identity[PROFILE_LINE_MAX];
+	char				*key;
+
+	ProfileIdentity(output, identity, sizeof(identity));
+
+	if ((key = ProfileKey(server, output))) {
+		profile = ProfileFind(server, key);
+		free(key);
+
+		if (profile && (o = ProfileFindOutput(profile, identity))) {
+			return o;
+		}
+	}
+
+	wl_list_for_each(profile, &server->profiles.list, link) {
+		if ((o = ProfileFindOutput(profile, identity))) {
+			return o;
+		}
+	}
+	return NULL;
+}
+
+/* Stage the mode, scale and transform from a profile for an output's next commit */
+void ProfileStage(struct wlr_output *output, mwdProfileOutput *o)
+{
+	struct wlr_output_mode	*mode;
+	struct wlr_output_mode	*found = NULL;
+
+	wlr_output_enable(output, o->enabled);
+	if (!o->enabled) {
+		return;
+	}
+
+	wl_list_for_each(mode, &output->modes, link) {
+		if (mode->width == o->width && mode->height == o->height && mode->refresh == o->refresh) {
+			found = mode;
+			break;
+		}
+	}
+
+	if (found) {
+		wlr_output_set_mode(output, found);
+	} else if (wl_list_empty(&output->modes)) {
+		wlr_output_set_custom_mode(output, o->width, o->height, o->refresh);
+	} else {
+		wlr_output_set_mode(output, wlr_output_preferred_mode(output));
+	}
+
+	wlr_output_set_scale(output, o->scale);
+	wlr_output_set_transform(output, o->transform);
+}
+
+/* Returns true if the output is already in the state from the profile */
+static bool ProfileMatches(mwdServer *server, mwdOutput *output, mwdProfileOutput *o)
+{
+	struct wlr_output	*wo		= output->output;
+	struct wlr_box		*box	= wlr_output_layout_get_box(server->layout, wo);
+
+	if (wo->enabled != o->enabled) {
+		return false;
+	}
+
+	if (!o->enabled) {
+		return true;
+	}
+
+	return box && box->x == o->x && box->y == o->y &&
+		wo->width == o->width && wo->height == o->height && wo->refresh == o->refresh &&
+		wo->scale == o->scale && wo->transform == o->transform;
+}
+
+/* Apply the profile for the connected monitors, if there is one */
+static void ProfileApply(void *data)
+{
+	mwdServer								*server		= data;
+	struct wlr_output_configuration_v1		*config;
+	struct wlr_output_configuration_head_v1	*head;
+	struct wlr_output_mode					*mode;
+	mwdProfile								*profile;
+	mwdProfileOutput						*o;
+	mwdOutput								*output;
+	char									identity[PROFILE_LINE_MAX];
+	char									*key;
+	bool									matches		= true;
+
+	server->profiles.idle = NULL;
+
+	/*
+		A downclocked output doesn't have the refresh rate it was configured
+		with, and would never match. Wait until it is restored.
+	*/
+	if (server->idle.downclocked) {
+		server->profiles.deferred = true;
+		return;
+	}
+	server->profiles.deferred = false;
+
+	if (!(key = ProfileKey(server, NULL))) {
+		return;
+	}
+	profile = ProfileFind(server, key);
+	free(key);
+
+	if (!profile || !(config = wlr_output_configuration_v1_create())) {
+		return;
+	}
+
+	wl_list_for_each(output, &server->outputs, link) {
+		/* Leave outputs that are powered off alone, instead of powering them on */
+		if (!output->powered || output->isVirtual) {
+			continue;
+		}
+		ProfileIdentity(output->output, identity, sizeof(identity));
+
+		if (!(head = wlr_output_configuration_head_v1_create(config, output->output))) {
+			goto done;
+		}
+
+		if (!(o = ProfileFindOutput(profile, identity))) {
+			continue;
+		}
+		matches &= ProfileMatches(server, output, o);
+
+		head->state.enabled			= o->enabled;
+		head->state.x				= o->x;
+		head->state.y				= o->y;
+		head->state.scale			= o->scale;
+		head->state.transform		= o->transform;
+		head->state.mode			= NULL;
+
+		wl_list_for_each(mode, &output->output->modes, link) {
+			if (mode->width == o->width && mode->height == o->height && mode->refresh == o->refresh) {
+				head->state.mode	= mode;
+				break;
+			}
+		}
+
+		if (!head->state.mode) {
+			head->state.custom_mode.width	= o->width;
+			head->state.custom_mode.height	= o->height;
+			head->state.custom_mode.refresh	= o->refresh;
+		}
+	}
+
+	if (!matches && !OutputConfigApply(server, config)) {
+		wlr_log(WLR_ERROR, "Failed to apply the output profile");
+	}
+
+done:
+	wlr_output_configuration_v1_destroy(config);
+}
+
+/* The connected monitors changed; apply their profile once things settle */
+void ProfileOutputsChanged(mwdServer *server)
+{
+	if (!server->profiles.idle) {
+		server->profiles.idle = wl_event_loop_add_idle(wl_display_get_event_loop(server->display), ProfileApply, server);
+	}
+}
+
+bool ProfileSetPath(mwdServer *server, const char *path)
+{
+	free(server->profiles.path);
+	return (server->profiles.path = strdup(path)) != NULL;
+}
+
+void ProfileMain(mwdServer *server)
+{
+	const char			*config	= getenv("XDG_CONFIG_HOME");
+	const char			*home	= getenv("HOME");
+	char				path[PATH_MAX];
+
+	wl_list_init(&server->profiles.list);
+	server->profiles.idle = NULL;
+
+	if (!server->profiles.path) {
+		if (config && *config) {
+			snprintf(path, sizeof(path), "%s/mwd/outputs", config);
+		} else if (home && *home) {
+			snprintf(path, sizeof(path), "%s/.config/mwd/outputs", home);
+		} else {
+			return;
+		}
+		server->profiles.path = strdup(path);
+	}
+
+	ProfileLoad(server);
+}
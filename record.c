@@ -0,0 +1,430 @@
+#include "../mwd.h"
+#include <wlr/backend/headless.h>
+
+/*
+	Input recording and replay
+
+	When started with -R <file> every input event mwd receives is written to
+	the file. When started with -P <file> mwd runs on the headless backend and
+	feeds the recorded events back into it at the same times, relative to the
+	start of the compositor, that they were originally received. The events are
+	emitted on headless input devices so they go through wlr_cursor and
+	wlr_keyboard and reach the same listeners in input.c as real input.
+
+	mwd exits when the replay is complete, so a replay combined with a fixed
+	set of windows started from the rc file gives a repeatable workload.
+
+	The file is a header followed by a sequence of events. Each event is a one
+	byte type, a four byte time offset in milliseconds and a payload with a
+	size that depends on the type. Values are stored in native byte order.
+*/
+
+#define RECORD_MAGIC		"MWDI"
+#define RECORD_VERSION		1
+
+enum {
+	RECORD_MOTION			= 1,
+	RECORD_MOTION_ABSOLUTE,
+	RECORD_BUTTON,
+	RECORD_AXIS,
+	RECORD_FRAME,
+	RECORD_KEY,
+
+	RECORD_TYPE_COUNT
+};
+
+typedef struct __attribute__((packed)) mwdRecordHeader
+{
+	char								magic[4];
+	uint32_t							version;
+} mwdRecordHeader;
+
+typedef struct __attribute__((packed)) mwdRecordEvent
+{
+	uint8_t								type;
+	uint32_t							time;
+
+	union {
+		struct __attribute__((packed)) {
+			float						dx, dy;
+			float						unaccelX, unaccelY;
+		} motion;
+
+		struct __attribute__((packed)) {
+			float						x, y;
+		} absolute;
+
+		struct __attribute__((packed)) {
+			uint32_t					button;
+			uint8_t						state;
+		} button;
+
+		struct __attribute__((packed)) {
+			uint8_t						orientation;
+			uint8_t						source;
+			int32_t						discrete;
+			float						delta;
+		} axis;
+
+		struct __attribute__((packed)) {
+			uint32_t					keycode;
+			uint8_t						state;
+		} key;
+	};
+} mwdRecordEvent;
+
+/* The size of the payload for each type of event */
+static const size_t RecordPayloadSize[RECORD_TYPE_COUNT] = {
+	[RECORD_MOTION]				= sizeof(((mwdRecordEvent *) 0)->motion),
+	[RECORD_MOTION_ABSOLUTE]	= sizeof(((mwdRecordEvent *) 0)->absolute),
+	[RECORD_BUTTON]				= sizeof(((mwdRecordEvent *) 0)->button),
+	[RECORD_AXIS]				= sizeof(((mwdRecordEvent *) 0)->axis),
+	[RECORD_FRAME]				= 0,
+	[RECORD_KEY]				= sizeof(((mwdRecordEvent *) 0)->key),
+};
+
+#define RECORD_EVENT_HEADER_SIZE	(sizeof(uint8_t) + sizeof(uint32_t))
+
+static uint32_t RecordNow(void)
+{
+	struct timespec		now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+static void RecordWrite(mwdServer *server, mwdRecordEvent *event)
+{
+	if (!server->record.file) {
+		return;
+	}
+
+	/* Store the time relative to the start of the compositor */
+	event->time = RecordNow() - server->record.start;
+
+	if (1 != fwrite(event, RECORD_EVENT_HEADER_SIZE + RecordPayloadSize[event->type], 1, server->record.file)) {
+		wlr_log_errno(WLR_ERROR, "Failed to record input; recording stopped");
+
+		fclose(server->record.file);
+		server->record.file = NULL;
+	}
+}
+
+void RecordMotion(mwdServer *server, struct wlr_event_pointer_motion *e)
+{
+	mwdRecordEvent		event = { .type = RECORD_MOTION };
+
+	if (!server->record.file) {
+		return;
+	}
+
+	event.motion.dx			= e->delta_x;
+	event.motion.dy			= e->delta_y;
+	event.motion.unaccelX	= e->unaccel_dx;
+	event.motion.unaccelY	= e->unaccel_dy;
+
+	RecordWrite(server, &event);
+}
+
+void RecordMotionAbsolute(mwdServer *server, struct wlr_event_pointer_motion_absolute *e)
+{
+	mwdRecordEvent		event = { .type = RECORD_MOTION_ABSOLUTE };
+
+	if (!server->record.file) {
+		return;
+	}
+
+	event.absolute.x		= e->x;
+	event.absolute.y		= e->y;
+
+	RecordWrite(server, &event);
+}
+
+void RecordButton(mwdServer *server, struct wlr_event_pointer_button *e)
+{
+	mwdRecordEvent		event = { .type = RECORD_BUTTON };
+
+	if (!server->record.file) {
+		return;
+	}
+
+	event.button.button		= e->button;
+	event.button.state		= e->state;
+
+	RecordWrite(server, &event);
+}
+
+void RecordAxis(mwdServer *server, struct wlr_event_pointer_axis *e)
+{
+	mwdRecordEvent		event = { .type = RECORD_AXIS };
+
+	if (!server->record.file) {
+		return;
+	}
+
+	event.axis.orientation	= e->orientation;
+	event.axis.source		= e->source;
+	event.axis.discrete		= e->delta_discrete;
+	event.axis.delta		= e->delta;
+
+	RecordWrite(server, &event);
+}
+
+void RecordFrame(mwdServer *server)
+{
+	mwdRecordEvent		event = { .type = RECORD_FRAME };
+
+	RecordWrite(server, &event);
+}
+
+void RecordKey(mwdServer *server, struct wlr_event_keyboard_key *e)
+{
+	mwdRecordEvent		event = { .type = RECORD_KEY };
+
+	if (!server->record.file) {
+		return;
+	}
+
+	event.key.keycode		= e->keycode;
+	event.key.state			= e->state;
+
+	RecordWrite(server, &event);
+}
+
+bool RecordStart(mwdServer *server, const char *path)
+{
+	mwdRecordHeader		header = { .magic = RECORD_MAGIC, .version = RECORD_VERSION };
+
+	if (!(server->record.file = fopen(path, "wb"))) {
+		wlr_log_errno(WLR_ERROR, "Failed to open %s for recording", path);
+		return false;
+	}
+
+	if (1 != fwrite(&header, sizeof(header), 1, server->record.file)) {
+		wlr_log_errno(WLR_ERROR, "Failed to write to %s", path);
+
+		fclose(server->record.file);
+		server->record.file = NULL;
+		return false;
+	}
+
+	server->record.start = RecordNow();
+	return true;
+}
+
+void RecordStop(mwdServer *server)
+{
+	if (server->record.file) {
+		fclose(server->record.file);
+		server->record.file = NULL;
+	}
+}
+
+/* Read the next event from the replay file. Returns false at the end. */
+static bool ReplayRead(mwdServer *server, mwdRecordEvent *event)
+{
+	FILE				*file = server->replay.file;
+
+	if (1 != fread(event, RECORD_EVENT_HEADER_SIZE, 1, file)) {
+		return false;
+	}
+
+	if (event->type == 0 || event->type >= RECORD_TYPE_COUNT) {
+		wlr_log(WLR_ERROR, "Invalid event in replay file");
+		return false;
+	}
+
+	if (RecordPayloadSize[event->type] &&
+		1 != fread((char *) event + RECORD_EVENT_HEADER_SIZE, RecordPayloadSize[event->type], 1, file)
+	) {
+		return false;
+	}
+	return true;
+}
+
+static void ReplayDispatch(mwdServer *server, mwdRecordEvent *event, uint32_t time)
+{
+	struct wlr_input_device		*pointer	= server->replay.pointer;
+	struct wlr_input_device		*keyboard	= server->replay.keyboard;
+
+	switch (event->type) {
+		case RECORD_MOTION: {
+			struct wlr_event_pointer_motion e = {
+				.device			= pointer,
+				.time_msec		= time,
+				.delta_x		= event->motion.dx,
+				.delta_y		= event->motion.dy,
+				.unaccel_dx		= event->motion.unaccelX,
+				.unaccel_dy		= event->motion.unaccelY
+			};
+
+			wl_signal_emit(&pointer->pointer->events.motion, &e);
+			break;
+		}
+
+		case RECORD_MOTION_ABSOLUTE: {
+			struct wlr_event_pointer_motion_absolute e = {
+				.device			= pointer,
+				.time_msec		= time,
+				.x				= event->absolute.x,
+				.y				= event->absolute.y
+			};
+
+			wl_signal_emit(&pointer->pointer->events.motion_absolute, &e);
+			break;
+		}
+
+		case RECORD_BUTTON: {
+			struct wlr_event_pointer_button e = {
+				.device			= pointer,
+				.time_msec		= time,
+				.button			= event->button.button,
+				.state			= event->button.state
+			};
+
+			wl_signal_emit(&pointer->pointer->events.button, &e);
+			break;
+		}
+
+		case RECORD_AXIS: {
+			struct wlr_event_pointer_axis e = {
+				.device			= pointer,
+				.time_msec		= time,
+				.source			= event->axis.source,
+				.orientation	= event->axis.orientation,
+				.delta			= event->axis.delta,
+				.delta_discrete	= event->axis.discrete
+			};
+
+			wl_signal_emit(&pointer->pointer->events.axis, &e);
+			break;
+		}
+
+		case RECORD_FRAME:
+			wl_signal_emit(&pointer->pointer->events.frame, pointer->pointer);
+			break;
+
+		case RECORD_KEY: {
+			struct wlr_event_keyboard_key e = {
+				.time_msec		= time,
+				.keycode		= event->key.keycode,
+				.update_state	= true,
+				.state			= event->key.state
+			};
+
+			/* This updates the xkb state and emits the key and modifier events */
+			wlr_keyboard_notify_key(keyboard->keyboard, &e);
+			break;
+		}
+	}
+}
+
+static int ReplayTimer(void *data)
+{
+	mwdServer			*server	= data;
+	mwdRecordEvent		*event	= server->replay.next;
+	uint32_t			elapsed;
+
+	for (;;) {
+		elapsed = RecordNow() - server->replay.start;
+
+		if ((int32_t) (event->time - elapsed) > 0) {
+			/* Wait for the next event */
+			wl_event_source_timer_update(server->replay.timer, event->time - elapsed);
+			return 0;
+		}
+
+		ReplayDispatch(server, event, server->replay.start + event->time);
+
+		if (!ReplayRead(server, event)) {
+			break;
+		}
+	}
+
+	wlr_log(WLR_INFO, "Replay complete");
+	ReplayStop(server);
+	wl_display_terminate(server->display);
+	return 0;
+}
+
+/* Open the replay file; this must be called before the backend is created */
+bool ReplayOpen(mwdServer *server, const char *path)
+{
+	mwdRecordHeader		header;
+
+	if (!(server->replay.file = fopen(path, "rb"))) {
+		wlr_log_errno(WLR_ERROR, "Failed to open %s for replay", path);
+		return false;
+	}
+
+	if (1 != fread(&header, sizeof(header), 1, server->replay.file) ||
+		memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) ||
+		header.version != RECORD_VERSION
+	) {
+		wlr_log(WLR_ERROR, "%s is not an mwd input recording", path);
+
+		fclose(server->replay.file);
+		server->replay.file = NULL;
+		return false;
+	}
+
+	if (!(server->replay.next = calloc(1, sizeof(mwdRecordEvent)))) {
+		fclose(server->replay.file);
+		server->replay.file = NULL;
+		return false;
+	}
+	return true;
+}
+
+/*
+	Create the input devices for the replay and start it. The backend must be
+	the headless backend, and it must have been started.
+*/
+bool ReplayStart(mwdServer *server)
+{
+	struct wl_event_loop		*loop	= wl_display_get_event_loop(server->display);
+
+	if (!server->replay.file) {
+		return false;
+	}
+
+	wlr_headless_add_output(server->backend, 1920, 1080);
+
+	server->replay.keyboard	= wlr_headless_add_input_device(server->backend, WLR_INPUT_DEVICE_KEYBOARD);
+	server->replay.pointer	= wlr_headless_add_input_device(server->backend, WLR_INPUT_DEVICE_POINTER);
+
+	if (!server->replay.keyboard || !server->replay.pointer) {
+		wlr_log(WLR_ERROR, "Failed to create input devices for replay");
+		return false;
+	}
+
+	if (!ReplayRead(server, server->replay.next)) {
+		wlr_log(WLR_ERROR, "Replay file is empty");
+		return false;
+	}
+
+	if (!(server->replay.timer = wl_event_loop_add_timer(loop, ReplayTimer, server))) {
+		return false;
+	}
+
+	server->replay.start = RecordNow();
+	wl_event_source_timer_update(server->replay.timer, 1);
+	return true;
+}
+
+void ReplayStop(mwdServer *server)
+{
+	if (server->replay.timer) {
+		wl_event_source_remove(server->replay.timer);
+		server->replay.timer = NULL;
+	}
+
+	if (server->replay.file) {
+		fclose(server->replay.file);
+		server->replay.file = NULL;
+	}
+
+	free(server->replay.next);
+	server->replay.next = NULL;
+}
+
@@ -0,0 +1,378 @@
+#include "../mwd.h"
+
+/*
+	Per application keyboard remapping
+
+	Rules are provided on the command line in the form:
+		<app_id>:<modifiers+key>=<modifiers+key>
+
+	For example, to send control+shift+c to a terminal when super+c is pressed:
+		kitty:logo+c=ctrl+shift+c
+
+	Rules are only parsed once, at startup. The first time a view with a given
+	app_id is mapped the rules for that app_id are compiled into a small hash
+	table keyed by keycode and modifiers, which is cached and shared by every
+	view with the same app_id. A change of keyboard focus simply swaps the
+	active table, so the key path never has to look at an app_id or a rule.
+
+	The keycodes depend on the keymap, so a table is built again if a key is
+	pressed on a keyboard with a different keymap than it was built for.
+*/
+
+/* Modifiers that should not effect the lookup, ie caps lock and num lock */
+#define REMAP_IGNORED_MODS		(WLR_MODIFIER_CAPS | WLR_MODIFIER_MOD2)
+
+static uint32_t RemapParseModifier(const char *name, size_t len)
+{
+	static const struct {
+		const char	*name;
+		uint32_t	mod;
+	} names[] = {
+		{ "shift",		WLR_MODIFIER_SHIFT	},
+		{ "ctrl",		WLR_MODIFIER_CTRL	},
+		{ "control",	WLR_MODIFIER_CTRL	},
+		{ "alt",		WLR_MODIFIER_ALT	},
+		{ "mod1",		WLR_MODIFIER_ALT	},
+		{ "logo",		WLR_MODIFIER_LOGO	},
+		{ "super",		WLR_MODIFIER_LOGO	},
+		{ "mod4",		WLR_MODIFIER_LOGO	},
+		{ "mod5",		WLR_MODIFIER_MOD5	},
+	};
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strlen(names[i].name) == len && !strncasecmp(names[i].name, name, len)) {
+			return names[i].mod;
+		}
+	}
+
+	return 0;
+}
+
+/* Parse a key combination such as "ctrl+shift+c" */
+static bool RemapParseKey(const char *str, uint32_t *mods, xkb_keysym_t *sym)
+{
+	const char		*plus;
+	uint32_t		mod;
+
+	*mods = 0;
+
+	while ((plus = strchr(str, '+'))) {
+		if (!(mod = RemapParseModifier(str, plus - str))) {
+			return false;
+		}
+
+		*mods |= mod;
+		str = plus + 1;
+	}
+
+	*sym = xkb_keysym_from_name(str, XKB_KEYSYM_CASE_INSENSITIVE);
+	return *sym != XKB_KEY_NoSymbol;
+}
+
+bool RemapAddRule(mwdServer *server, const char *rule)
+{
+	mwdRemapRule	*r;
+	char			*copy, *from, *to;
+
+	if (!(copy = strdup(rule))) {
+		return false;
+	}
+
+	if (!(from = strchr(copy, ':')) || !(to = strchr(from, '='))) {
+		goto failure;
+	}
+	*from++	= '\0';
+	*to++	= '\0';
+
+	if (!(r = calloc(1, sizeof(mwdRemapRule)))) {
+		goto failure;
+	}
+
+	if (!RemapParseKey(from, &r->from.mods, &r->from.sym) ||
+		!RemapParseKey(to, &r->to.mods, &r->to.sym)
+	) {
+		free(r);
+		goto failure;
+	}
+
+	/* The remaining portion of the copy is the app_id */
+	r->appId = copy;
+
+	wl_list_insert(server->remap.rules.prev, &r->link);
+	return true;
+
+failure:
+	wlr_log(WLR_ERROR, "Invalid keyboard remap rule: %s", rule);
+	free(copy);
+	return false;
+}
+
+static inline uint32_t RemapKey(uint32_t keycode, uint32_t mods)
+{
+	return (keycode << 8) | (mods & 0xff);
+}
+
+static inline uint32_t RemapHash(mwdRemapTable *table, uint32_t key)
+{
+	/* Fibonacci hashing; size is always a power of 2 */
+	return (key * 2654435761u) & (table->size - 1);
+}
+
+typedef struct mwdRemapKeycodeSearch
+{
+	xkb_keysym_t				sym;
+	xkb_keycode_t				keycode;
+} mwdRemapKeycodeSearch;
+
+static void RemapFindKeycode(struct xkb_keymap *keymap, xkb_keycode_t keycode, void *data)
+{
+	mwdRemapKeycodeSearch		*search = data;
+	const xkb_keysym_t			*syms;
+	int							nsyms;
+
+	if (search->keycode) {
+		return;
+	}
+
+	/* Only the base level of the first layout is considered */
+	nsyms = xkb_keymap_key_get_syms_by_level(keymap, keycode, 0, 0, &syms);
+	for (int i = 0; i < nsyms; i++) {
+		if (syms[i] == search->sym) {
+			search->keycode = keycode;
+			return;
+		}
+	}
+}
+
+/* Returns the libinput keycode for a keysym, or 0 if it can't be found */
+static uint32_t RemapKeycode(struct xkb_keymap *keymap, xkb_keysym_t sym)
+{
+	mwdRemapKeycodeSearch		search = { .sym = sym, .keycode = 0 };
+
+	xkb_keymap_key_for_each(keymap, RemapFindKeycode, &search);
+
+	if (search.keycode < 8) {
+		return 0;
+	}
+
+	/* Translate xkbcommon -> libinput keycode */
+	return search.keycode - 8;
+}
+
+static void RemapTableInsert(mwdRemapTable *table, uint32_t key, uint32_t keycode, uint32_t mods)
+{
+	uint32_t		i;
+
+	for (i = RemapHash(table, key); table->entries[i].used; i = (i + 1) & (table->size - 1)) {
+		if (table->entries[i].key == key) {
+			/* The first matching rule wins */
+			return;
+		}
+	}
+
+	table->entries[i].used		= true;
+	table->entries[i].key		= key;
+	table->entries[i].keycode	= keycode;
+	table->entries[i].mods		= mods;
+}
+
+/* Fill in the table's entries using the keycodes from the specified keymap */
+static void RemapBuild(mwdServer *server, mwdRemapTable *table, struct xkb_keymap *keymap)
+{
+	mwdRemapRule		*rule;
+	uint32_t			from, to;
+
+	if (table->keymap) {
+		xkb_keymap_unref(table->keymap);
+	}
+	table->keymap	= xkb_keymap_ref(keymap);
+	table->count	= 0;
+	memset(table->entries, 0, table->size * sizeof(table->entries[0]));
+
+	wl_list_for_each(rule, &server->remap.rules, link) {
+		if (strcmp(rule->appId, table->appId)) {
+			continue;
+		}
+
+		if (!(from = RemapKeycode(keymap, rule->from.sym)) ||
+			!(to = RemapKeycode(keymap, rule->to.sym))
+		) {
+			wlr_log(WLR_ERROR, "Keyboard remap rule for %s uses a key that is not in the keymap", table->appId);
+			continue;
+		}
+
+		RemapTableInsert(table, RemapKey(from, rule->from.mods), to, rule->to.mods);
+		table->count++;
+	}
+}
+
+static mwdRemapTable *RemapCompile(mwdServer *server, const char *appId, struct xkb_keymap *keymap)
+{
+	mwdRemapTable		*table;
+	mwdRemapRule		*rule;
+
+	if (!(table = calloc(1, sizeof(mwdRemapTable)))) {
+		return NULL;
+	}
+
+	if (!(table->appId = strdup(appId))) {
+		free(table);
+		return NULL;
+	}
+
+	wl_list_for_each(rule, &server->remap.rules, link) {
+		if (!strcmp(rule->appId, appId)) {
+			table->rules++;
+		}
+	}
+
+	if (table->rules == 0) {
+		/*
+			Cache the fact that there are no rules for this app_id as well, so
+			it doesn't need to be looked up again.
+		*/
+		wl_list_insert(&server->remap.tables, &table->link);
+		return table;
+	}
+
+	/* Keep the load factor at or below 50% */
+	for (table->size = 4; table->size < table->rules * 2; table->size *= 2);
+
+	if (!(table->entries = calloc(table->size, sizeof(table->entries[0])))) {
+		free(table->appId);
+		free(table);
+		return NULL;
+	}
+
+	RemapBuild(server, table, keymap);
+
+	wl_list_insert(&server->remap.tables, &table->link);
+	return table;
+}
+
+/*
+	Return the compiled remap table for the specified app_id, compiling it if
+	needed. This is intended to be called when a view is mapped, not per key.
+*/
+mwdRemapTable *RemapFind(mwdServer *server, const char *appId)
+{
+	mwdRemapTable		*table;
+	struct wlr_keyboard	*keyboard;
+
+	if (!appId || wl_list_empty(&server->remap.rules)) {
+		return NULL;
+	}
+
+	wl_list_for_each(table, &server->remap.tables, link) {
+		if (!strcmp(table->appId, appId)) {
+			return table->rules ? table : NULL;
+		}
+	}
+
+	/* A keymap is needed to resolve keysyms to keycodes */
+	if (!(keyboard = wlr_seat_get_keyboard(server->seat)) || !keyboard->keymap) {
+		return NULL;
+	}
+
+	if ((table = RemapCompile(server, appId, keyboard->keymap)) && table->rules) {
+		return table;
+	}
+	return NULL;
+}
+
+/*
+	The seat's keyboard focus changed, by any means; use the table for the view
+	that has it now. Layer surfaces and override-redirect X11 windows aren't
+	views, so they are never remapped.
+*/
+void RemapFocus(mwdServer *server, struct wlr_surface *surface)
+{
+	mwdView				*view	= NULL;
+
+	if (surface) {
+		view = ViewFindBySurface(server, surface);
+	}
+	server->remap.active = view ? view->remap : NULL;
+}
+
+/*
+	Called on every key press, so this has to be cheap. Returns true if the key
+	was remapped and sent to the client.
+*/
+bool RemapKeyPress(mwdKeyboard *keyboard, uint32_t time, uint32_t keycode, uint32_t modifiers)
+{
+	mwdServer						*server	= keyboard->server;
+	mwdRemapTable					*table	= server->remap.active;
+	struct wlr_keyboard_modifiers	mods;
+	uint32_t						key;
+	uint32_t						i;
+
+	if (!table) {
+		return false;
+	}
+
+	if (table->keymap != keyboard->device->keyboard->keymap) {
+		RemapBuild(server, table, keyboard->device->keyboard->keymap);
+	}
+
+	key = RemapKey(keycode, modifiers & ~REMAP_IGNORED_MODS);
+	for (i = RemapHash(table, key); table->entries[i].used; i = (i + 1) & (table->size - 1)) {
+		if (table->entries[i].key == key) {
+			break;
+		}
+	}
+
+	if (!table->entries[i].used) {
+		return false;
+	}
+
+	/* Remember what this key was remapped to so the release matches */
+	for (size_t p = 0; p < WLR_KEYBOARD_KEYS_CAP; p++) {
+		if (!keyboard->remapped[p].from) {
+			keyboard->remapped[p].from	= keycode;
+			keyboard->remapped[p].to	= table->entries[i].keycode;
+			break;
+		}
+	}
+
+	/*
+		The WLR_MODIFIER_* values match the modifier indexes of a standard xkb
+		keymap, so they can be sent to the client as a depressed mask.
+	*/
+	mods			= keyboard->device->keyboard->modifiers;
+	mods.depressed	= table->entries[i].mods;
+	mods.latched	= 0;
+
+	wlr_seat_set_keyboard(server->seat, keyboard->device);
+	wlr_seat_keyboard_notify_modifiers(server->seat, &mods);
+	wlr_seat_keyboard_notify_key(server->seat, time, table->entries[i].keycode, WL_KEYBOARD_KEY_STATE_PRESSED);
+	wlr_seat_keyboard_notify_modifiers(server->seat, &keyboard->device->keyboard->modifiers);
+	return true;
+}
+
+/* Returns true if the released key had been remapped when it was pressed */
+bool RemapKeyRelease(mwdKeyboard *keyboard, uint32_t time, uint32_t keycode)
+{
+	mwdServer						*server	= keyboard->server;
+
+	for (size_t p = 0; p < WLR_KEYBOARD_KEYS_CAP; p++) {
+		if (keyboard->remapped[p].from == keycode) {
+			wlr_seat_set_keyboard(server->seat, keyboard->device);
+			wlr_seat_keyboard_notify_key(server->seat, time, keyboard->remapped[p].to, WL_KEYBOARD_KEY_STATE_RELEASED);
+
+			keyboard->remapped[p].from	= 0;
+			keyboard->remapped[p].to	= 0;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void RemapMain(mwdServer *server)
+{
+	wl_list_init(&server->remap.rules);
+	wl_list_init(&server->remap.tables);
+	server->remap.active = NULL;
+}
+
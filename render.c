@@ -56,6 +56,57 @@ static void RenderBorders(struct viv_view *view, struct viv_output *output, bool
 }
 #endif
 
+/* Add a surface to the layers being collected for software composition */
+static void RenderCollect(mwdOutput *output, struct wlr_surface *surface, struct wlr_box *box)
+{
+	mwdComposeLayer				*layers;
+	int							size;
+
+	if (output->compose.fallback) {
+		return;
+	}
+
+	if (output->compose.count == output->compose.size) {
+		size = output->compose.size ? output->compose.size * 2 : 16;
+
+		if (!(layers = realloc(output->compose.layers, size * sizeof(mwdComposeLayer)))) {
+			output->compose.fallback = true;
+			return;
+		}
+		output->compose.layers	= layers;
+		output->compose.size	= size;
+	}
+
+	if (!ComposeSurfaceLayer(surface, box, &output->compose.layers[output->compose.count])) {
+		output->compose.fallback = true;
+		return;
+	}
+	output->compose.count++;
+}
+
+/* Draw the buffer that was saved for a view, at the geometry it was saved at */
+static void RenderSavedBuffer(mwdView *view, struct wlr_surface *surface, mwdRenderData *rdata)
+{
+	struct wlr_output			*o		= rdata->output;
+	struct wlr_box				box;
+	double						ox		= 0;
+	double						oy		= 0;
+	float						matrix[9];
+
+	wlr_output_layout_output_coords(view->server->layout, o, &ox, &oy);
+
+	box.x		= (view->saved.left + ox) * o->scale;
+	box.y		= (view->saved.top + oy) * o->scale;
+	box.width	= view->saved.width * o->scale;
+	box.height	= view->saved.height * o->scale;
+
+	wlr_matrix_project_box(matrix, &box, wlr_output_transform_invert(view->saved.transform), 0, o->transform_matrix);
+	wlr_render_texture_with_matrix(rdata->renderer, view->saved.buffer->texture, matrix, 1);
+
+	/* The client still needs frame callbacks to be able to draw its new state */
+	wlr_surface_send_frame_done(surface, &rdata->when);
+}
+
 void RenderSurface(struct wlr_surface *surface, int sx, int sy, void *data)
 {
 	/* This function is called for every view that needs to be rendered. */
@@ -71,13 +122,34 @@ void RenderSurface(struct wlr_surface *surface, int sx, int sy, void *data)
 	float						matrix[9];
 	enum wl_output_transform	transform;
 
+	if (rdata->saved && surface == ViewGetSurface(view)) {
+		RenderSavedBuffer(view, surface, rdata);
+		return;
+	}
+
 	if (!(texture = wlr_surface_get_texture(surface))) {
 		return;
 	}
 
-	ViewGetRenderPos(view, &top, &right, &bottom, &left);
+	if (view && rdata->saved) {
+		/* Subsurfaces and popups are drawn live, relative to the saved buffer */
+		top		= view->saved.top;
+		left	= view->saved.left;
+		bottom	= top + view->saved.height;
+		right	= left + view->saved.width;
 
-	if (surface == ViewGetSurface(view)) {
+		wlr_output_layout_output_coords(view->server->layout, output, &ox, &oy);
+	} else if (view) {
+		ViewGetRenderPos(view, &top, &right, &bottom, &left);
+
+		/* Calculate the coordinates for this view relative to the output */
+		wlr_output_layout_output_coords(view->server->layout, output, &ox, &oy);
+	} else {
+		/* Surfaces without a view are positioned by the caller, relative to the output */
+		top = right = bottom = left = 0;
+	}
+
+	if (view && surface == ViewGetSurface(view)) {
 		width = right - left;
 		height = bottom - top;
 	} else {
@@ -85,9 +157,6 @@ void RenderSurface(struct wlr_surface *surface, int sx, int sy, void *data)
 		height = surface->current.height;
 	}
 
-	/* Calculate the coordinates for this view relative to the output */
-	wlr_output_layout_output_coords(view->server->layout, output, &ox, &oy);
-
 	box.height	= height;
 	box.width	= width;
 	box.y		= top + oy;
@@ -105,6 +174,12 @@ void RenderSurface(struct wlr_surface *surface, int sx, int sy, void *data)
 	box.width	*= output->scale;
 	box.height	*= output->scale;
 
+	if (output->data && ((mwdOutput *) output->data)->compose.collecting) {
+		/* Frame done is sent by RenderCompose, or by drawing it again if that fails */
+		RenderCollect(output->data, surface, &box);
+		return;
+	}
+
 	transform	= wlr_output_transform_invert(surface->current.transform);
 	wlr_matrix_project_box(matrix, &box, transform, 0, output->transform_matrix);
 
@@ -115,6 +190,36 @@ void RenderSurface(struct wlr_surface *surface, int sx, int sy, void *data)
 	wlr_surface_send_frame_done(surface, &rdata->when);
 }
 
+/*
+	Render a view whose transaction is in flight. Its main surface is drawn
+	from the buffer that was saved, and its subsurfaces and popups are drawn
+	live around it so that they don't disappear until the transaction is done.
+*/
+void RenderSaved(mwdView *view, struct wlr_renderer *renderer, mwdOutput *output)
+{
+	mwdRenderData				rdata;
+
+	if (!view->saved.buffer || !view->saved.buffer->texture) {
+		return;
+	}
+
+	if (output->compose.collecting) {
+		/* The saved buffer is only a texture, so it has to be drawn by the renderer */
+		output->compose.fallback = true;
+		return;
+	}
+
+	memset(&rdata, 0, sizeof(rdata));
+
+	rdata.output		= output->output;
+	rdata.renderer		= renderer;
+	rdata.view			= view;
+	rdata.saved			= true;
+
+	clock_gettime(CLOCK_MONOTONIC, &rdata.when);
+	ViewForEachSurface(view, RenderSurface, &rdata);
+}
+
 void RenderPopupSurface(struct wlr_surface *surface, int sx, int sy, void *data)
 {
 	mwdRenderData				*rdata	= data;
@@ -125,18 +230,147 @@ void RenderPopupSurface(struct wlr_surface *surface, int sx, int sy, void *data)
     wlr_surface_for_each_surface(surface, RenderSurface, rdata);
 }
 
+/* Sort by layer and then by draw order, bottom first */
+static int RenderCompare(const void *a, const void *b)
+{
+	const mwdViewHot	*ha = *(const mwdViewHot **) a;
+	const mwdViewHot	*hb = *(const mwdViewHot **) b;
+
+	if (ha->layer != hb->layer) {
+		return ha->layer < hb->layer ? -1 : 1;
+	}
+
+	return ha->seq < hb->seq ? -1 : (ha->seq > hb->seq);
+}
+
+/*
+	Compose the frame in software, with the workers in compose.c, and draw the
+	result as a single texture. The views are collected by the same functions
+	that draw them, but RenderSurface adds a layer instead. Returns false if
+	anything can't be composed this way, so the frame is drawn as normal.
+*/
+static bool RenderCompose(mwdOutput *output, struct wlr_renderer *renderer,
+		mwdViewHot **order, uint32_t count, float color[4])
+{
+	struct wlr_output			*o			= output->output;
+	int							stride		= o->width * sizeof(uint32_t);
+	uint32_t					*pixels;
+	uint32_t					background;
+	struct timespec				start, end;
+	struct wlr_box				box			= { 0, 0, o->width, o->height };
+	float						matrix[9];
+
+	if (o->transform != WL_OUTPUT_TRANSFORM_NORMAL || o->width <= 0 || o->height <= 0) {
+		return false;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	output->compose.collecting	= true;
+	output->compose.fallback	= false;
+	output->compose.count		= 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		RenderView(order[i]->view, renderer, output);
+	}
+	XWaylandRenderUnmanaged(output, renderer);
+
+	output->compose.collecting	= false;
+
+	if (output->compose.fallback) {
+		return false;
+	}
+
+	if (o->width != output->compose.width || o->height != output->compose.height) {
+		if (!(pixels = realloc(output->compose.pixels, (size_t) stride * o->height))) {
+			return false;
+		}
+		output->compose.pixels	= pixels;
+		output->compose.width	= o->width;
+		output->compose.height	= o->height;
+
+		if (output->compose.texture) {
+			wlr_texture_destroy(output->compose.texture);
+			output->compose.texture = NULL;
+		}
+	}
+
+	background = 0xff000000 |
+		((uint32_t) (color[0] * 255) << 16) |
+		((uint32_t) (color[1] * 255) << 8) |
+		((uint32_t) (color[2] * 255));
+
+	ComposeFrame(&output->server->compose.pool, output->compose.pixels, o->width, o->height, stride,
+			background, output->compose.layers, output->compose.count);
+
+	/* The frame is opaque, and XRGB layers are copied as is, so ignore the alpha */
+	if (!output->compose.texture) {
+		output->compose.texture = wlr_texture_from_pixels(renderer, WL_SHM_FORMAT_XRGB8888,
+				stride, o->width, o->height, output->compose.pixels);
+	} else if (!wlr_texture_write_pixels(output->compose.texture, stride, o->width, o->height,
+			0, 0, 0, 0, output->compose.pixels)) {
+		wlr_texture_destroy(output->compose.texture);
+		output->compose.texture = NULL;
+	}
+
+	if (!output->compose.texture) {
+		return false;
+	}
+
+	wlr_matrix_project_box(matrix, &box, WL_OUTPUT_TRANSFORM_NORMAL, 0, o->transform_matrix);
+	wlr_render_texture_with_matrix(renderer, output->compose.texture, matrix, 1);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	HistogramAdd(&output->compose.hist, StatsElapsed(&start, &end));
+
+	/* Let the clients know that their surfaces have been displayed */
+	for (int i = 0; i < output->compose.count; i++) {
+		wlr_surface_send_frame_done(output->compose.layers[i].surface, &end);
+	}
+	return true;
+}
+
+void RenderOutputInit(mwdOutput *output)
+{
+	output->output->data = output;
+	HistogramInit(&output->compose.hist, "software composition");
+}
+
+void RenderOutputDestroy(mwdOutput *output)
+{
+	if (output->compose.texture) {
+		wlr_texture_destroy(output->compose.texture);
+	}
+	free(output->compose.pixels);
+	free(output->compose.layers);
+	output->output->data = NULL;
+}
+
 void RenderFrame(struct wl_listener *listener, void *data)
 {
 	mwdOutput				*output		= wl_container_of(listener, output, frame);
 	struct wlr_renderer		*renderer	= output->server->renderer;
+	mwdStore				*store		= &output->server->views.store;
 	mwdView					*view;
+	mwdViewHot				*hot;
+	uint32_t				count		= 0;
 	struct timespec			now;
 	int						width, height;
 	float					color[4]	= {0.3, 0.3, 0.3, 1.0};
-	mwdLayer				layer;
 
 	clock_gettime(CLOCK_MONOTONIC, &now);
 
+	/*
+		Send the X11 configures that were held back, so this frame can show
+		them. This is done even if the frame is skipped.
+	*/
+	XWaylandFlushConfigures(output->server);
+
+	/* Don't render virtual outputs that nobody is looking at */
+	if (!output->powered || !VirtualIsConsumed(output) || IdleThrottleFrame(output)) {
+		return;
+	}
+
 	/* wlr_output_attach_render makes the OpenGL context current. */
 	if (!wlr_output_attach_render(output->output, NULL)) {
 		return;
@@ -147,23 +381,40 @@ void RenderFrame(struct wl_listener *listener, void *data)
 	/* Begin the renderer (calls glViewport and some other GL sanity checks) */
 	wlr_renderer_begin(renderer, width, height);
 
-	// TODO Let a user configure this color
-	wlr_renderer_clear(renderer, color);
+	/*
+		Collect the drawn views that overlap this output, and render them bottom
+		to top; by layer and then by draw order. Only drawn views are in the
+		visible draw order list, so hidden tags cost nothing here.
+	*/
+	wl_list_for_each_reverse(view, &output->server->views.visible.drawOrder, link.visible.drawOrder) {
+		hot = StoreHot(view);
+
+		if (hot->unbounded || !output->mask || (hot->outputs & output->mask)) {
+			store->order[count++] = hot;
+		}
+	}
+
+	qsort(store->order, count, sizeof(mwdViewHot *), RenderCompare);
 
-	for (layer = MWD_LAYER_BEFORE + 1; layer < MWD_LAYER_AFTER; layer++) {
-		wl_list_for_each_reverse(view, &output->server->views.drawOrder, link.drawOrder) {
-			if (view->renderLayer != layer) {
-				continue;
-			}
+	if (!output->server->compose.threads || !RenderCompose(output, renderer, store->order, count, color)) {
+		// TODO Let a user configure this color
+		wlr_renderer_clear(renderer, color);
 
-			RenderView(view, renderer, output);
+		for (uint32_t i = 0; i < count; i++) {
+			RenderView(store->order[i]->view, renderer, output);
 		}
+
+		/* Override-redirect X11 surfaces go above every view */
+		XWaylandRenderUnmanaged(output, renderer);
 	}
 
 	wlr_output_render_software_cursors(output->output, NULL);
 
 	/* Conclude rendering, swap the buffers, show the final frame on screen */
 	wlr_renderer_end(renderer);
-	wlr_output_commit(output->output);
+	if (wlr_output_commit(output->output)) {
+		LatencyFrameCommitted(output);
+		TagFrameCommitted(output);
+	}
 }
 
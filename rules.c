@@ -0,0 +1,439 @@
+#include "../mwd.h"
+
+/*
+	Window rules
+
+	Rules are provided on the command line in the form:
+		<app_id>[/<title regex>/]:<action>[,<action>...]
+
+	An app_id of * matches any view. The actions are:
+		tags=<tag>[+<tag>...]	Place the view on the specified tags
+		floating				Don't tile the view
+		tiled					Tile the view
+
+	For example:
+		firefox:tags=2
+		firefox/^Picture-in-Picture$/:floating
+
+	When more than one rule matches a view they are applied in the order they
+	were given, so later rules win.
+
+	The rules are compiled once, at startup. Rules for a specific app_id are
+	found with a hash table, and the title patterns of the rules that apply to
+	any app_id are combined into a single regex so that a title that doesn't
+	match any of them is rejected with one match instead of one per rule.
+
+	The result is cached on the view, and is only evaluated again when the
+	view's title or app_id actually changes.
+*/
+
+#define RULES_MAX_MATCHES		64
+
+static uint32_t RulesHash(const char *str)
+{
+	/* FNV-1a */
+	uint32_t		hash = 2166136261u;
+
+	while (*str) {
+		hash ^= (uint8_t) *str++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static bool RulesParseTags(const char *str, uint32_t *tags)
+{
+	char			*end;
+	long			tag;
+
+	*tags = 0;
+
+	do {
+		tag = strtol(str, &end, 10);
+		if (end == str || tag < 1 || tag > MWD_TAG_COUNT) {
+			return false;
+		}
+
+		*tags |= 1 << (tag - 1);
+		str = end + 1;
+	} while (*end == '+');
+
+	return *end == '\0';
+}
+
+static bool RulesParseActions(mwdRule *rule, char *actions)
+{
+	char			*action;
+	char			*save;
+
+	for (action = strtok_r(actions, ",", &save); action; action = strtok_r(NULL, ",", &save)) {
+		if (!strncasecmp(action, "tags=", 5)) {
+			if (!RulesParseTags(action + 5, &rule->tags)) {
+				return false;
+			}
+		} else if (!strcasecmp(action, "floating")) {
+			rule->floating = 1;
+		} else if (!strcasecmp(action, "tiled")) {
+			rule->floating = 0;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool RulesAdd(mwdServer *server, const char *str)
+{
+	mwdRule			*rule;
+	char			*copy, *p, *end, *actions;
+
+	if (!(copy = strdup(str)) || !(rule = calloc(1, sizeof(mwdRule)))) {
+		free(copy);
+		return false;
+	}
+	rule->floating = -1;
+
+	/* The app_id ends with either the start of the title pattern or the actions */
+	p = copy + strcspn(copy, "/:");
+
+	if (*p == '/') {
+		/* The title pattern ends at the last "/:", since it may contain either */
+		for (end = NULL, actions = p; (actions = strstr(actions + 1, "/:")); end = actions);
+
+		if (!end) {
+			goto failure;
+		}
+		*p		= '\0';
+		*end	= '\0';
+		actions	= end + 2;
+
+		if (!(rule->title = strdup(p + 1)) ||
+			regcomp(&rule->regex, rule->title, REG_EXTENDED | REG_NOSUB)
+		) {
+			wlr_log(WLR_ERROR, "Invalid title pattern in rule: %s", str);
+			free(rule->title);
+			rule->title = NULL;
+			goto failure;
+		}
+	} else if (*p == ':') {
+		*p		= '\0';
+		actions	= p + 1;
+	} else {
+		goto failure;
+	}
+
+	if (strcmp(copy, "*") && !(rule->appId = strdup(copy))) {
+		goto failure;
+	}
+
+	if (!RulesParseActions(rule, actions)) {
+		goto failure;
+	}
+
+	rule->index = server->rules.count++;
+	wl_list_insert(server->rules.list.prev, &rule->link);
+
+	free(copy);
+	return true;
+
+failure:
+	wlr_log(WLR_ERROR, "Invalid rule: %s", str);
+
+	if (rule->title) {
+		regfree(&rule->regex);
+		free(rule->title);
+	}
+	free(rule->appId);
+	free(rule);
+	free(copy);
+	return false;
+}
+
+static mwdRule *RulesFindAppId(mwdServer *server, const char *appId)
+{
+	uint32_t		hash	= RulesHash(appId);
+	uint32_t		mask	= server->rules.size - 1;
+
+	if (!server->rules.size) {
+		return NULL;
+	}
+
+	for (uint32_t i = hash & mask; server->rules.table[i].rule; i = (i + 1) & mask) {
+		if (server->rules.table[i].hash == hash && !strcmp(server->rules.table[i].rule->appId, appId)) {
+			return server->rules.table[i].rule;
+		}
+	}
+	return NULL;
+}
+
+/* Returns true if the pattern has a back-reference, ie \1 */
+static bool RulesHasBackref(const char *pattern)
+{
+	for (const char *p = pattern; *p; p++) {
+		if (*p == '\\' && *++p >= '1' && *p <= '9') {
+			return true;
+		}
+		if (!*p) {
+			break;
+		}
+	}
+	return false;
+}
+
+/* Build the app_id hash table and the combined title regex */
+bool RulesCompile(mwdServer *server)
+{
+	mwdRule			*rule;
+	mwdRule			**tail;
+	mwdRule			*first;
+	uint32_t		hash, mask;
+	size_t			len		= 1;
+	int				count	= 0;
+	int				titles	= 0;
+	char			*pattern;
+	bool			backrefs	= false;
+
+	/* Size the table to keep it at most half full */
+	wl_list_for_each(rule, &server->rules.list, link) {
+		if (rule->appId) {
+			count++;
+		} else {
+			server->rules.anyCount++;
+
+			if (rule->title) {
+				titles++;
+				len += strlen(rule->title) + 3;
+				backrefs |= RulesHasBackref(rule->title);
+			}
+		}
+	}
+
+	if (count) {
+		for (server->rules.size = 4; server->rules.size < (uint32_t) count * 2; server->rules.size <<= 1);
+
+		if (!(server->rules.table = calloc(server->rules.size, sizeof(server->rules.table[0])))) {
+			return false;
+		}
+	}
+	mask = server->rules.size - 1;
+
+	if (server->rules.anyCount &&
+		!(server->rules.anyRules = calloc(server->rules.anyCount, sizeof(mwdRule *)))
+	) {
+		return false;
+	}
+	server->rules.anyCount = 0;
+
+	wl_list_for_each(rule, &server->rules.list, link) {
+		if (!rule->appId) {
+			server->rules.anyRules[server->rules.anyCount++] = rule;
+			continue;
+		}
+
+		/* Rules with the same app_id are chained, in order */
+		if ((first = RulesFindAppId(server, rule->appId))) {
+			for (tail = &first->next; *tail; tail = &(*tail)->next);
+			*tail = rule;
+			continue;
+		}
+
+		hash = RulesHash(rule->appId);
+		for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+			if (!server->rules.table[i].rule) {
+				server->rules.table[i].hash	= hash;
+				server->rules.table[i].rule	= rule;
+				break;
+			}
+		}
+	}
+
+	/*
+		Wrapping the patterns in groups renumbers their back-references, so the
+		combined pattern could reject a title that one of them matches.
+	*/
+	if (!titles || backrefs) {
+		return true;
+	}
+
+	/* Combine the title patterns into a single regex: (a)|(b)|(c) */
+	if (!(pattern = calloc(1, len))) {
+		return false;
+	}
+
+	for (int i = 0; i < server->rules.anyCount; i++) {
+		if (!(rule = server->rules.anyRules[i])->title) {
+			continue;
+		}
+
+		if (*pattern) {
+			strcat(pattern, "|");
+		}
+		strcat(pattern, "(");
+		strcat(pattern, rule->title);
+		strcat(pattern, ")");
+	}
+
+	/* Without the combined pattern each title pattern is simply checked on its own */
+	if (!(server->rules.hasTitleSet = !regcomp(&server->rules.titleSet, pattern, REG_EXTENDED | REG_NOSUB))) {
+		wlr_log(WLR_ERROR, "Failed to combine the title patterns, checking each one: %s", pattern);
+	}
+	free(pattern);
+	return true;
+}
+
+static bool RulesTitleMatches(mwdRule *rule, const char *title)
+{
+	return !rule->title || !regexec(&rule->regex, title, 0, NULL, 0);
+}
+
+static void RulesApplyRule(mwdRuleResult *result, mwdRule *rule)
+{
+	if (rule->tags) {
+		result->tags = rule->tags;
+	}
+	if (rule->floating >= 0) {
+		result->floating = rule->floating;
+	}
+}
+
+/* Replace a cached string if it changed; returns true if it did */
+static bool RulesUpdateString(char **cached, const char *value)
+{
+	if (*cached && !strcmp(*cached, value)) {
+		return false;
+	}
+
+	free(*cached);
+	*cached = strdup(value);
+	return true;
+}
+
+/*
+	Evaluate the rules for the view, if its title or app_id has changed since
+	the last time. Returns true if the result changed.
+*/
+bool RulesEvaluate(mwdView *view)
+{
+	mwdServer		*server		= view->server;
+	const char		*appId		= ViewGetAppId(view);
+	const char		*title		= ViewGetTitle(view);
+	mwdRule			*matches[RULES_MAX_MATCHES];
+	mwdRule			*rule;
+	mwdRuleResult	result		= { .tags = 0, .floating = -1 };
+	int				count		= 0;
+	int				i, j;
+	bool			titleMatch;
+	bool			changed;
+
+	if (!server->rules.count) {
+		return false;
+	}
+
+	appId	= appId ? appId : "";
+	title	= title ? title : "";
+
+	changed  = RulesUpdateString(&view->rules.appId, appId);
+	changed |= RulesUpdateString(&view->rules.title, title);
+
+	if (!changed) {
+		return false;
+	}
+
+	/* Rules for this app_id, in order */
+	for (rule = RulesFindAppId(server, appId); rule && count < RULES_MAX_MATCHES; rule = rule->next) {
+		if (RulesTitleMatches(rule, title)) {
+			matches[count++] = rule;
+		}
+	}
+
+	/*
+		Merge in the rules that apply to any app_id, keeping the order. The
+		title patterns are only checked one at a time if the combined pattern
+		matched, or if there is no combined pattern.
+	*/
+	titleMatch = !server->rules.hasTitleSet || !regexec(&server->rules.titleSet, title, 0, NULL, 0);
+
+	for (i = 0, j = 0; i < count || j < server->rules.anyCount; ) {
+		if (j < server->rules.anyCount && (i == count || server->rules.anyRules[j]->index < matches[i]->index)) {
+			rule = server->rules.anyRules[j++];
+
+			if (rule->title && (!titleMatch || !RulesTitleMatches(rule, title))) {
+				continue;
+			}
+		} else {
+			rule = matches[i++];
+		}
+
+		RulesApplyRule(&result, rule);
+	}
+
+	if (result.tags == view->rules.result.tags && result.floating == view->rules.result.floating) {
+		return false;
+	}
+
+	view->rules.result = result;
+	return true;
+}
+
+/* Apply the cached result to a view that is already mapped */
+static void RulesApply(mwdView *view)
+{
+	mwdRuleResult	*result = &view->rules.result;
+
+	if (result->tags) {
+		TagSetView(view, result->tags);
+	}
+
+	if (result->floating >= 0 && view->floating != result->floating) {
+		view->floating = result->floating;
+		TileMarkTagsDirty(view->output, view->tags);
+	}
+}
+
+static void RulesChanged(mwdView *view)
+{
+	if (RulesEvaluate(view) && view->mapped) {
+		RulesApply(view);
+	}
+}
+
+static void RulesSetTitle(struct wl_listener *listener, void *data)
+{
+	mwdView			*view = wl_container_of(listener, view, rules.setTitle);
+
+	RulesChanged(view);
+}
+
+static void RulesSetAppId(struct wl_listener *listener, void *data)
+{
+	mwdView			*view = wl_container_of(listener, view, rules.setAppId);
+
+	RulesChanged(view);
+}
+
+void RulesViewInit(mwdView *view)
+{
+	view->rules.result.tags		= 0;
+	view->rules.result.floating	= -1;
+
+	view->rules.setTitle.notify	= RulesSetTitle;
+	view->rules.setAppId.notify	= RulesSetAppId;
+	wl_list_init(&view->rules.setTitle.link);
+	wl_list_init(&view->rules.setAppId.link);
+}
+
+void RulesViewDestroy(mwdView *view)
+{
+	wl_list_remove(&view->rules.setTitle.link);
+	wl_list_remove(&view->rules.setAppId.link);
+
+	free(view->rules.appId);
+	free(view->rules.title);
+	view->rules.appId = NULL;
+	view->rules.title = NULL;
+}
+
+void RulesMain(mwdServer *server)
+{
+	wl_list_init(&server->rules.list);
+}
@@ -0,0 +1,124 @@
+#include "../mwd.h"
+#include <signal.h>
+
+/*
+	Simple histograms for instrumenting the compositor
+
+	All histograms are dumped to the log when mwd receives SIGUSR1, and again
+	on exit. ie:
+		pkill -USR1 mwd
+*/
+
+/* The upper bound (in microseconds) of each bucket, the last is unbounded */
+static const uint64_t HistogramBounds[MWD_HISTOGRAM_BUCKETS] = {
+	1000,	2000,	3000,	4000,
+	6000,	8000,	12000,	16000,
+	24000,	32000,	48000,	64000,
+	96000,	128000,	256000,	UINT64_MAX
+};
+
+void HistogramInit(mwdHistogram *hist, const char *name)
+{
+	memset(hist, 0, sizeof(mwdHistogram));
+	hist->name = name;
+}
+
+void HistogramAdd(mwdHistogram *hist, uint64_t usec)
+{
+	int			i;
+
+	for (i = 0; i < MWD_HISTOGRAM_BUCKETS - 1 && usec > HistogramBounds[i]; i++);
+
+	hist->buckets[i]++;
+
+	if (hist->count == 0 || usec < hist->min) {
+		hist->min = usec;
+	}
+	if (usec > hist->max) {
+		hist->max = usec;
+	}
+
+	hist->count++;
+	hist->total += usec;
+}
+
+void HistogramDump(mwdHistogram *hist, const char *prefix)
+{
+	uint64_t	lower = 0;
+
+	if (!hist->count) {
+		wlr_log(WLR_INFO, "%s%s: no samples", prefix ? prefix : "", hist->name);
+		return;
+	}
+
+	wlr_log(WLR_INFO, "%s%s: %lu samples, min %.2fms, avg %.2fms, max %.2fms",
+			prefix ? prefix : "", hist->name, (unsigned long) hist->count,
+			hist->min / 1000.0, (hist->total / hist->count) / 1000.0, hist->max / 1000.0);
+
+	for (int i = 0; i < MWD_HISTOGRAM_BUCKETS; i++) {
+		if (hist->buckets[i]) {
+			if (HistogramBounds[i] == UINT64_MAX) {
+				wlr_log(WLR_INFO, "\t>= %3lums: %lu", (unsigned long) (lower / 1000), (unsigned long) hist->buckets[i]);
+			} else {
+				wlr_log(WLR_INFO, "\t<  %3lums: %lu", (unsigned long) (HistogramBounds[i] / 1000), (unsigned long) hist->buckets[i]);
+			}
+		}
+		lower = HistogramBounds[i];
+	}
+}
+
+/* Return the number of microseconds between two timestamps */
+uint64_t StatsElapsed(struct timespec *start, struct timespec *end)
+{
+	int64_t		usec;
+
+	usec = (int64_t) (end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+	return usec < 0 ? 0 : usec;
+}
+
+void StatsDump(mwdServer *server)
+{
+	mwdOutput		*output;
+	char			prefix[64];
+
+	wl_list_for_each(output, &server->outputs, link) {
+		snprintf(prefix, sizeof(prefix), "%s: ", output->output->name);
+
+		HistogramDump(&output->latency.hist, prefix);
+		HistogramDump(&output->tag.hist, prefix);
+
+		if (server->compose.threads) {
+			HistogramDump(&output->compose.hist, prefix);
+		}
+	}
+
+	if (server->generator.fd >= 0) {
+		wlr_log(WLR_INFO, "layout generator: %lu cache hits, %lu requests, %lu timeouts",
+				(unsigned long) server->generator.hits, (unsigned long) server->generator.misses,
+				(unsigned long) server->generator.timeouts);
+	}
+
+	HistogramDump(&server->xwayland.coldHist, NULL);
+	HistogramDump(&server->xwayland.warmHist, NULL);
+
+	wlr_log(WLR_INFO, "output layout: %lu changes, %lu updates, %lu client notifications",
+			(unsigned long) server->output.layout.changes, (unsigned long) server->output.layout.updates,
+			(unsigned long) server->output.layout.notifies);
+
+	HistogramDump(&server->transaction.hist, NULL);
+	wlr_log(WLR_INFO, "layout transaction timeouts: %lu", (unsigned long) server->transaction.timeouts);
+}
+
+static int StatsSignal(int signal, void *data)
+{
+	StatsDump((mwdServer *) data);
+	return 0;
+}
+
+void StatsMain(mwdServer *server)
+{
+	struct wl_event_loop	*loop = wl_display_get_event_loop(server->display);
+
+	server->stats.signal = wl_event_loop_add_signal(loop, SIGUSR1, StatsSignal, server);
+}
+
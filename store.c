@@ -0,0 +1,143 @@
+#include "../mwd.h"
+
+/*
+	View storage
+
+	Views are allocated from slabs of MWD_STORE_SLAB views, which are never
+	moved or freed while the compositor runs, so a view's address and handle
+	stay the same for as long as it exists. The handle is the index of the
+	view's slot, and is also the index of the view's entry in the hot array.
+
+	The hot array holds only the fields that are read by every traversal
+	(bounds, layer, outputs, draw order and surface) packed together, so that
+	rendering and hit-testing can reject a view from the visible list, and a
+	surface can be found, without reading the whole of each view. Everything
+	else, including the shell specific state, stays in the view itself.
+
+	Free slots are kept on a stack so that the most recently freed (and most
+	likely still cached) slot is reused first. Scans stop at the highest slot
+	that has ever been used.
+*/
+
+static bool StoreGrow(mwdServer *server)
+{
+	mwdStore		*store	= &server->views.store;
+	mwdViewSlab		**slabs;
+	mwdViewHot		*hot;
+	mwdViewHot		**order;
+	uint32_t		*stack;
+	uint32_t		size	= store->size + MWD_STORE_SLAB;
+
+	if (!(slabs = realloc(store->slabs, (store->slabCount + 1) * sizeof(mwdViewSlab *)))) {
+		return false;
+	}
+	store->slabs = slabs;
+
+	if (!(hot = realloc(store->hot, size * sizeof(mwdViewHot)))) {
+		return false;
+	}
+	store->hot = hot;
+
+	if (!(stack = realloc(store->free, size * sizeof(uint32_t)))) {
+		return false;
+	}
+	store->free = stack;
+
+	if (!(order = realloc(store->order, size * sizeof(mwdViewHot *)))) {
+		return false;
+	}
+	store->order = order;
+
+	if (!(store->slabs[store->slabCount] = calloc(1, sizeof(mwdViewSlab)))) {
+		return false;
+	}
+	store->slabCount++;
+
+	memset(&store->hot[store->size], 0, MWD_STORE_SLAB * sizeof(mwdViewHot));
+
+	/* Push the new slots so that the lowest is used first */
+	for (uint32_t i = size; i > store->size; i--) {
+		store->free[store->freeCount++] = i - 1;
+	}
+	store->size = size;
+	return true;
+}
+
+mwdView *StoreAlloc(mwdServer *server)
+{
+	mwdStore		*store	= &server->views.store;
+	mwdView			*view;
+	uint32_t		handle;
+
+	if (!store->freeCount && !StoreGrow(server)) {
+		wlr_log(WLR_ERROR, "Failed to grow the view store");
+		return NULL;
+	}
+
+	handle	= store->free[--store->freeCount];
+	view	= StoreView(server, handle);
+
+	memset(view, 0, sizeof(mwdView));
+	view->handle = handle;
+
+	memset(&store->hot[handle], 0, sizeof(mwdViewHot));
+	store->hot[handle].view = view;
+
+	if (handle >= store->used) {
+		store->used = handle + 1;
+	}
+	store->count++;
+	return view;
+}
+
+void StoreFree(mwdView *view)
+{
+	mwdStore		*store;
+
+	if (!view) {
+		return;
+	}
+	store = &view->server->views.store;
+
+	memset(&store->hot[view->handle], 0, sizeof(mwdViewHot));
+	store->free[store->freeCount++] = view->handle;
+	store->count--;
+
+	/* Let scans stop sooner if the highest slots are free */
+	while (store->used && !store->hot[store->used - 1].view) {
+		store->used--;
+	}
+}
+
+/* Return the view for a handle; the handle must be for an allocated slot */
+mwdView *StoreView(mwdServer *server, mwdViewHandle handle)
+{
+	mwdStore		*store	= &server->views.store;
+
+	return &store->slabs[handle / MWD_STORE_SLAB]->views[handle % MWD_STORE_SLAB];
+}
+
+mwdViewHot *StoreHot(mwdView *view)
+{
+	return &view->server->views.store.hot[view->handle];
+}
+
+void StoreMain(mwdServer *server)
+{
+	memset(&server->views.store, 0, sizeof(mwdStore));
+}
+
+void StoreFinish(mwdServer *server)
+{
+	mwdStore		*store	= &server->views.store;
+
+	for (uint32_t i = 0; i < store->slabCount; i++) {
+		free(store->slabs[i]);
+	}
+
+	free(store->slabs);
+	free(store->hot);
+	free(store->free);
+	free(store->order);
+	memset(store, 0, sizeof(mwdStore));
+}
@@ -0,0 +1,352 @@
+#include "../mwd.h"
+
+/*
+	dwm style tags
+
+	Each view has a bitmask of the tags it is on, and each output has a bitmask
+	of the tags that are selected. A view is visible when it is mapped and it
+	is on at least one of the selected tags of its output.
+
+	Each output keeps a list of the views on each tag, and the server keeps
+	lists of only the visible views (in both draw and user order) so that
+	rendering, hit-testing and focus cycling never have to skip over hidden
+	views. Selecting tags only walks the lists for the tags that changed, so
+	only the views entering or leaving visibility are touched.
+
+	The visible lists are kept in the same order as the full lists by sorting
+	on a sequence number that is assigned when a view is created (user order)
+	or raised (draw order). New and raised views always go at the front, so the
+	common case doesn't have to search.
+*/
+
+static bool TagWantsVisible(mwdView *view)
+{
+	return view->mapped && view->output && (view->tags & view->output->tag.selected);
+}
+
+static void TagInsertDrawOrder(mwdServer *server, mwdView *view)
+{
+	mwdView			*other;
+
+	wl_list_for_each(other, &server->views.visible.drawOrder, link.visible.drawOrder) {
+		if (other->seq.draw < view->seq.draw) {
+			wl_list_insert(other->link.visible.drawOrder.prev, &view->link.visible.drawOrder);
+			return;
+		}
+	}
+
+	wl_list_insert(server->views.visible.drawOrder.prev, &view->link.visible.drawOrder);
+}
+
+static void TagInsertUserOrder(mwdServer *server, mwdView *view)
+{
+	mwdView			*other;
+
+	wl_list_for_each(other, &server->views.visible.userOrder, link.visible.userOrder) {
+		if (other->seq.user < view->seq.user) {
+			wl_list_insert(other->link.visible.userOrder.prev, &view->link.visible.userOrder);
+			return;
+		}
+	}
+
+	wl_list_insert(server->views.visible.userOrder.prev, &view->link.visible.userOrder);
+}
+
+/*
+	Add or remove the view from the visible lists if its visibility changed.
+
+	A view that has been culled by the layout (because it is scrolled off of
+	the output) is left out of the draw order, so it isn't rendered or hit
+	tested, but it stays in the user order so it can still be focused.
+*/
+static void TagUpdate(mwdView *view)
+{
+	mwdServer		*server	= view->server;
+	bool			visible	= TagWantsVisible(view);
+	bool			drawn	= visible && !view->culled;
+
+	if (drawn != view->drawn) {
+		view->drawn = drawn;
+
+		if (drawn) {
+			TagInsertDrawOrder(server, view);
+		} else {
+			wl_list_remove(&view->link.visible.drawOrder);
+			wl_list_init(&view->link.visible.drawOrder);
+		}
+	}
+
+	if (visible != view->visible) {
+		view->visible = visible;
+
+		if (!visible) {
+			wl_list_remove(&view->link.visible.userOrder);
+			wl_list_init(&view->link.visible.userOrder);
+		} else if (view->type != MWD_LAYER_SHELL) {
+			/* Layer shell views can't be selected by the user */
+			TagInsertUserOrder(server, view);
+		}
+
+		/* An idle inhibitor only counts while its view is visible */
+		if (!wl_list_empty(&server->idle.inhibitors)) {
+			IdleUpdateInhibit(server);
+		}
+	}
+
+	ViewSyncStore(view);
+}
+
+/* Set if the view is outside of the output's viewport */
+void TagSetCulled(mwdView *view, bool culled)
+{
+	if (view->culled == culled) {
+		return;
+	}
+
+	view->culled = culled;
+	TagUpdate(view);
+}
+
+/* Add the view to the tag lists of its output; called when it is mapped */
+void TagLink(mwdView *view)
+{
+	if (view->output) {
+		for (int i = 0; i < MWD_TAG_COUNT; i++) {
+			if (view->tags & (1 << i)) {
+				wl_list_insert(&view->output->tag.views[i], &view->link.tag[i]);
+			}
+		}
+	}
+
+	TagUpdate(view);
+}
+
+/* Remove the view from all tag lists, and from the visible lists */
+void TagUnlink(mwdView *view)
+{
+	for (int i = 0; i < MWD_TAG_COUNT; i++) {
+		wl_list_remove(&view->link.tag[i]);
+		wl_list_init(&view->link.tag[i]);
+	}
+
+	TagUpdate(view);
+}
+
+/*
+	If the focused view is no longer visible then focus the newest visible
+	view, preferring one on the output that changed.
+*/
+static void TagFixFocus(mwdServer *server, mwdOutput *output)
+{
+	mwdView			*view;
+	mwdView			*fallback	= NULL;
+
+	if ((view = ViewFocused(server)) && view->visible) {
+		return;
+	}
+
+	wl_list_for_each(view, &server->views.visible.userOrder, link.visible.userOrder) {
+		if (view->output == output) {
+			ViewFocus(view, true);
+			return;
+		}
+
+		if (!fallback) {
+			fallback = view;
+		}
+	}
+
+	if (fallback) {
+		ViewFocus(fallback, true);
+	} else {
+		wlr_seat_keyboard_clear_focus(server->seat);
+	}
+}
+
+/*
+	Move the view to another output. A view that moves keeps being visible by
+	taking on the selected tags of its new output.
+*/
+void TagSetOutput(mwdView *view, mwdOutput *output)
+{
+	mwdOutput		*old	= view->output;
+	uint32_t		tags	= view->tags;
+
+	if (old == output) {
+		return;
+	}
+
+	TagUnlink(view);
+	view->output = output;
+
+	if (old && output && view->type != MWD_LAYER_SHELL) {
+		view->tags = output->tag.selected;
+	}
+
+	if (view->mapped) {
+		TagLink(view);
+	}
+
+	TileMarkTagsDirty(old, tags);
+	TileMarkTagsDirty(output, view->tags);
+}
+
+/* Set the tags a view is on */
+void TagSetView(mwdView *view, uint32_t tags)
+{
+	tags &= MWD_TAG_ALL;
+
+	if (!view || !tags || view->tags == tags || view->type == MWD_LAYER_SHELL) {
+		return;
+	}
+
+	TagUnlink(view);
+	TileMarkTagsDirty(view->output, view->tags | tags);
+	view->tags = tags;
+	if (view->mapped) {
+		TagLink(view);
+	}
+
+	TagFixFocus(view->server, view->output);
+}
+
+void TagToggleView(mwdView *view, uint32_t tags)
+{
+	if (!view) {
+		return;
+	}
+
+	/* A view must always be on at least one tag */
+	TagSetView(view, view->tags ^ tags);
+}
+
+/* Select the tags that are visible on an output */
+void TagSelect(mwdOutput *output, uint32_t tags)
+{
+	mwdView			*view;
+	uint32_t		changed;
+
+	if (!output) {
+		return;
+	}
+
+	tags &= MWD_TAG_ALL;
+	if (!tags || !(changed = output->tag.selected ^ tags)) {
+		return;
+	}
+
+	output->tag.previous	= output->tag.selected;
+	output->tag.selected	= tags;
+
+	/* Measure how long it takes for the switch to be shown */
+	clock_gettime(CLOCK_MONOTONIC, &output->tag.switched);
+	output->tag.switching	= true;
+
+	/* Only the views on tags that were added or removed can change */
+	for (int i = 0; i < MWD_TAG_COUNT; i++) {
+		if (changed & (1 << i)) {
+			wl_list_for_each(view, &output->tag.views[i], link.tag[i]) {
+				TagUpdate(view);
+			}
+		}
+	}
+
+	/* The views on tags that were just hidden are still where they were shown */
+	TileMarkTagsDirty(output, output->tag.previous & ~tags);
+	TagFixFocus(output->server, output);
+}
+
+void TagToggle(mwdOutput *output, uint32_t tags)
+{
+	if (!output) {
+		return;
+	}
+
+	TagSelect(output, output->tag.selected ^ tags);
+}
+
+/* Select the tags that were selected before the last change */
+void TagSelectPrevious(mwdOutput *output)
+{
+	if (!output) {
+		return;
+	}
+
+	TagSelect(output, output->tag.previous);
+}
+
+/*
+	A frame has been committed to the output. The first one after a tag switch
+	that isn't still showing saved buffers from a layout transaction is the
+	first frame that shows the result of the switch.
+*/
+void TagFrameCommitted(mwdOutput *output)
+{
+	struct timespec		now;
+
+	if (!output->tag.switching || output->tile.dirty || output->server->transaction.active) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	HistogramAdd(&output->tag.hist, StatsElapsed(&output->tag.switched, &now));
+	output->tag.switching = false;
+}
+
+/* Move the view to the top of the visible draw order */
+void TagRaise(mwdView *view)
+{
+	view->seq.draw = ++view->server->views.drawSeq;
+
+	if (view->drawn) {
+		wl_list_remove(&view->link.visible.drawOrder);
+		wl_list_insert(&view->server->views.visible.drawOrder, &view->link.visible.drawOrder);
+	}
+	StoreHot(view)->seq = view->seq.draw;
+}
+
+void TagViewInit(mwdView *view)
+{
+	mwdServer		*server = view->server;
+
+	view->seq.draw	= ++server->views.drawSeq;
+	view->seq.user	= ++server->views.userSeq;
+
+	wl_list_init(&view->link.visible.drawOrder);
+	wl_list_init(&view->link.visible.userOrder);
+
+	for (int i = 0; i < MWD_TAG_COUNT; i++) {
+		wl_list_init(&view->link.tag[i]);
+	}
+}
+
+void TagOutputInit(mwdOutput *output)
+{
+	mwdServer		*server = output->server;
+	mwdView			*view;
+
+	output->tag.selected	= 1;
+	output->tag.previous	= 1;
+	HistogramInit(&output->tag.hist, "tag switch to first frame");
+
+	for (int i = 0; i < MWD_TAG_COUNT; i++) {
+		wl_list_init(&output->tag.views[i]);
+	}
+
+	/* Adopt any views that were left behind when the last output went away */
+	wl_list_for_each(view, &server->views.userOrder, link.userOrder) {
+		if (!view->output) {
+			view->tags = output->tag.selected;
+			TagSetOutput(view, output);
+		}
+	}
+}
+
+void TagMain(mwdServer *server)
+{
+	wl_list_init(&server->views.visible.drawOrder);
+	wl_list_init(&server->views.visible.userOrder);
+
+	server->views.drawSeq	= 0;
+	server->views.userSeq	= 0;
+}
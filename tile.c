@@ -0,0 +1,525 @@
+#include "../mwd.h"
+
+/*
+	Tiling layouts
+
+	Each output has its own layout and parameters. Any change that effects the
+	layout of an output (a view being mapped, unmapped or moved to another
+	output, a parameter changing, the output changing size, etc) marks only
+	that output as dirty. All dirty outputs are arranged once when the event
+	loop is idle, so a burst of changes results in a single pass.
+
+	The results are applied through ViewSetPos, as a single transaction, and
+	only for views whose geometry actually changed, so mapping a single view
+	does not reconfigure every other client.
+
+	The scrolling layout (paperwm style) places each view in a column on a
+	strip that may be much wider than the output, and the output shows the
+	part of the strip at its scroll offset. Scrolling only moves the views,
+	which doesn't need the clients to do anything, and views that end up
+	entirely outside of the output are culled so that they aren't rendered,
+	hit-tested or sent frame callbacks. They stay in the user order, so
+	focusing one scrolls it into view.
+
+	The views on hidden tags are arranged as well, at the geometry they would
+	have if their tag was the only one selected. Those clients resize and draw
+	while they are hidden, and since the surface keeps its last buffer the
+	views can be shown as soon as the tag is selected, with no configure
+	round trip. Each output tracks which of its hidden tags are dirty (their
+	views, or the layout parameters, changed) so that arranging the selected
+	tags doesn't lay out every hidden tag again.
+*/
+
+#define TILE_MAX_VIEWS			512
+#define TILE_RATIO_MIN			0.1
+#define TILE_RATIO_MAX			0.9
+
+/* Returns true if the view should be placed by the layout */
+bool TileIsTiled(mwdView *view)
+{
+	if (!view || !view->mapped || view->floating || !view->output) {
+		return false;
+	}
+
+	/* Only shells that know how to answer this can be tiled */
+	if (!view->cb || !view->cb->is.floating) {
+		return false;
+	}
+
+	return !view->cb->is.floating(view);
+}
+
+/* Split the box vertically into count rows, and place row i */
+static void TileRow(mwdTileBox *area, int i, int count, mwdTileBox *box)
+{
+	double		height = (area->bottom - area->top) / count;
+
+	box->left	= area->left;
+	box->right	= area->right;
+	box->top	= area->top + (int) (height * i);
+	box->bottom	= (i == count - 1) ? area->bottom : area->top + (int) (height * (i + 1));
+}
+
+/* dwm style; masterCount views on the left, the rest stacked on the right */
+static void TileMasterStack(mwdOutput *output, mwdTileBox *area, int count, mwdTileBox *boxes)
+{
+	mwdTileBox	master	= *area;
+	mwdTileBox	stack	= *area;
+	int			nmaster	= output->tile.masterCount;
+	int			i;
+
+	if (nmaster > count) {
+		nmaster = count;
+	}
+
+	if (nmaster > 0 && count > nmaster) {
+		master.right	= area->left + (int) ((area->right - area->left) * output->tile.masterRatio);
+		stack.left		= master.right;
+	} else if (nmaster == 0) {
+		master.right	= area->left;
+	}
+
+	for (i = 0; i < nmaster; i++) {
+		TileRow(&master, i, nmaster, &boxes[i]);
+	}
+
+	for (i = nmaster; i < count; i++) {
+		TileRow(&stack, i - nmaster, count - nmaster, &boxes[i]);
+	}
+}
+
+/* m-column; the views are split evenly into up to m stacked columns */
+static void TileColumns(mwdOutput *output, mwdTileBox *area, int count, mwdTileBox *boxes)
+{
+	int			columns	= output->tile.columns;
+	int			i, c, first, rows;
+	double		width;
+	mwdTileBox	column;
+
+	if (columns > count) {
+		columns = count;
+	}
+	if (columns < 1) {
+		columns = 1;
+	}
+	width = (area->right - area->left) / columns;
+
+	for (c = 0, first = 0; c < columns; c++, first += rows) {
+		/* The first columns get any views that don't divide evenly */
+		rows = count / columns + (c < count % columns ? 1 : 0);
+
+		column.top		= area->top;
+		column.bottom	= area->bottom;
+		column.left		= area->left + (int) (width * c);
+		column.right	= (c == columns - 1) ? area->right : area->left + (int) (width * (c + 1));
+
+		for (i = 0; i < rows; i++) {
+			TileRow(&column, i, rows, &boxes[first + i]);
+		}
+	}
+}
+
+/* paperwm style; one full height column per view, on a strip that scrolls */
+static void TileScrolling(mwdOutput *output, mwdTileBox *area, int count, mwdTileBox *boxes, double *offset)
+{
+	double		width	= (int) ((area->right - area->left) * output->tile.scroll.width);
+	double		max		= count * width - (area->right - area->left);
+
+	/* Don't scroll past either end of the strip */
+	if (*offset > max) {
+		*offset = max;
+	}
+	if (*offset < 0) {
+		*offset = 0;
+	}
+
+	for (int i = 0; i < count; i++) {
+		boxes[i].top	= area->top;
+		boxes[i].bottom	= area->bottom;
+		boxes[i].left	= area->left + width * i - (int) *offset;
+		boxes[i].right	= boxes[i].left + width;
+	}
+}
+
+/* The area left once layer surfaces have taken their exclusive zones */
+static bool TileGetArea(mwdOutput *output, mwdTileBox *area)
+{
+	*area = output->usableArea;
+
+	return area->right > area->left && area->bottom > area->top;
+}
+
+/*
+	Fill out the boxes for count views. Returns false if the layout is being
+	generated externally and isn't ready yet.
+
+	The offset is the scroll position for the scrolling layout, which is
+	clamped to the ends of the strip.
+*/
+static bool TileLayout(mwdOutput *output, mwdTileBox *area, int count, mwdTileBox *boxes, double *offset)
+{
+	if (output->tile.kind == MWD_TILE_SCROLLING) {
+		/* The strip doesn't fit in the area, so a generator can't describe it */
+		TileScrolling(output, area, count, boxes, offset);
+		return true;
+	}
+
+	switch (GeneratorLayout(output, area, count, boxes)) {
+		case MWD_GENERATOR_DONE:
+			return true;
+
+		case MWD_GENERATOR_WAITING:
+			return false;
+
+		case MWD_GENERATOR_BUILTIN:
+			break;
+	}
+
+	switch (output->tile.kind) {
+		default:
+		case MWD_TILE_MASTER_STACK:
+			TileMasterStack(output, area, count, boxes);
+			break;
+
+		case MWD_TILE_COLUMNS:
+			TileColumns(output, area, count, boxes);
+			break;
+	}
+	return true;
+}
+
+static bool TileUnchanged(mwdView *view, mwdTileBox *box)
+{
+	return view->top == box->top && view->right == box->right &&
+		view->bottom == box->bottom && view->left == box->left;
+}
+
+static bool TileSameSize(mwdView *view, mwdTileBox *box)
+{
+	return view->right - view->left == box->right - box->left &&
+		view->bottom - view->top == box->bottom - box->top;
+}
+
+static bool TileIsOutside(mwdTileBox *box, mwdTileBox *area)
+{
+	return box->right <= area->left || box->left >= area->right ||
+		box->bottom <= area->top || box->top >= area->bottom;
+}
+
+/* Newest first, to match the userOrder list */
+static int TileCompareUserOrder(const void *a, const void *b)
+{
+	const mwdView	*va	= *(const mwdView **) a;
+	const mwdView	*vb	= *(const mwdView **) b;
+
+	return (va->seq.user < vb->seq.user) - (va->seq.user > vb->seq.user);
+}
+
+/*
+	Configure the hidden views on each dirty unselected tag. A view on more
+	than one hidden tag is placed for the lowest of them.
+*/
+static void TilePreconfigure(mwdOutput *output, mwdTileBox *area)
+{
+	mwdView			*view;
+	mwdView			*views[TILE_MAX_VIEWS];
+	mwdTileBox		boxes[TILE_MAX_VIEWS];
+	mwdTileBox		*last	= &output->tile.hiddenArea;
+	int				count;
+	double			offset;
+
+	/* Every hidden tag depends on the area */
+	if (area->top != last->top || area->right != last->right ||
+		area->bottom != last->bottom || area->left != last->left
+	) {
+		output->tile.hiddenDirty	= MWD_TAG_ALL;
+		*last						= *area;
+	}
+
+	for (int tag = 0; tag < MWD_TAG_COUNT; tag++) {
+		if ((output->tag.selected & (1 << tag)) || !(output->tile.hiddenDirty & (1 << tag))) {
+			continue;
+		}
+
+		count = 0;
+		wl_list_for_each(view, &output->tag.views[tag], link.tag[tag]) {
+			if (!view->visible && TileIsTiled(view) && !(view->tags & ((1 << tag) - 1)) && count < TILE_MAX_VIEWS) {
+				views[count++] = view;
+			}
+		}
+
+		if (count == 0) {
+			output->tile.hiddenDirty &= ~(1 << tag);
+			continue;
+		}
+
+		/* The tag lists are not kept in order */
+		qsort(views, count, sizeof(mwdView *), TileCompareUserOrder);
+		/* Hidden views are placed at the start of their strip */
+		offset = 0;
+		if (!TileLayout(output, area, count, boxes, &offset)) {
+			/* Still dirty; the generator's reply arranges it again */
+			continue;
+		}
+		output->tile.hiddenDirty &= ~(1 << tag);
+
+		for (int i = 0; i < count; i++) {
+			view = views[i];
+
+			if (TileUnchanged(view, &boxes[i])) {
+				continue;
+			}
+
+			ViewSetEdges(view, WLR_EDGE_TOP | WLR_EDGE_LEFT);
+			ViewSetPos(view, boxes[i].top, boxes[i].right, boxes[i].bottom, boxes[i].left);
+
+			/* A hidden view gets no frame callbacks, which it may need to draw */
+			ViewSendFrameDone(view);
+		}
+	}
+}
+
+void TileArrange(mwdOutput *output)
+{
+	mwdServer		*server = output->server;
+	mwdView			*view;
+	mwdView			*views[TILE_MAX_VIEWS];
+	mwdTileBox		boxes[TILE_MAX_VIEWS];
+	mwdTileBox		area;
+	mwdTransaction	*txn;
+	int				count	= 0;
+
+	output->tile.dirty = false;
+
+	if (!TileGetArea(output, &area)) {
+		return;
+	}
+
+	/*
+		The userOrder list has the newest view first, which matches the dwm
+		behavior of a new view becoming the master. Only views on a selected
+		tag are in the visible list.
+	*/
+	wl_list_for_each(view, &server->views.visible.userOrder, link.visible.userOrder) {
+		if (view->output != output) {
+			continue;
+		}
+
+		if (TileIsTiled(view) && count < TILE_MAX_VIEWS) {
+			views[count++] = view;
+		} else if (view->culled) {
+			/* Only the layout culls views, so a view it doesn't place is shown */
+			TagSetCulled(view, false);
+		}
+	}
+
+	/* While waiting for an external layout the views are left as they are */
+	if (count > 0 && TileLayout(output, &area, count, boxes, &output->tile.scroll.offset)) {
+
+		/* Apply all of the changes at once, in a single frame */
+		txn = NULL;
+
+		for (int i = 0; i < count; i++) {
+			view = views[i];
+
+			/*
+				Nothing changed; don't bother the client. A view that was
+				preconfigured while hidden but hasn't caught up yet is still
+				added to the transaction so that it is waited for.
+			*/
+			if (TileUnchanged(view, &boxes[i]) && ViewIsConfigured(view)) {
+				TagSetCulled(view, TileIsOutside(&boxes[i], &area));
+				continue;
+			}
+
+			TagSetCulled(view, TileIsOutside(&boxes[i], &area));
+
+			if (TileSameSize(view, &boxes[i]) && ViewIsConfigured(view)) {
+				/* Only moved (ie scrolled); the client doesn't need to do anything */
+				ViewSetEdges(view, WLR_EDGE_TOP | WLR_EDGE_LEFT);
+				ViewSetPos(view, boxes[i].top, boxes[i].right, boxes[i].bottom, boxes[i].left);
+				continue;
+			}
+
+			if (!txn) {
+				txn = TransactionBegin(server);
+			}
+
+			/* Tiled views are always positioned from the top left */
+			ViewSetEdges(view, WLR_EDGE_TOP | WLR_EDGE_LEFT);
+			TransactionSetPos(txn, view, boxes[i].top, boxes[i].right, boxes[i].bottom, boxes[i].left);
+		}
+
+		TransactionCommit(txn);
+	}
+
+	TilePreconfigure(output, &area);
+}
+
+static void TileIdle(void *data)
+{
+	mwdServer		*server = data;
+	mwdOutput		*output;
+
+	server->tile.idle = NULL;
+
+	/* An output that is powered off stays dirty until it is powered on */
+	wl_list_for_each(output, &server->outputs, link) {
+		if (output->tile.dirty && output->powered) {
+			TileArrange(output);
+		}
+	}
+}
+
+/* Schedule the output to be arranged the next time the event loop is idle */
+void TileMarkDirty(mwdOutput *output)
+{
+	mwdServer				*server;
+	struct wl_event_loop	*loop;
+
+	if (!output) {
+		return;
+	}
+	server = output->server;
+
+	output->tile.dirty = true;
+
+	if (!server->tile.idle) {
+		loop = wl_display_get_event_loop(server->display);
+		server->tile.idle = wl_event_loop_add_idle(loop, TileIdle, server);
+	}
+}
+
+/* The views on the specified tags changed, so they have to be arranged again if hidden */
+void TileMarkTagsDirty(mwdOutput *output, uint32_t tags)
+{
+	if (!output) {
+		return;
+	}
+
+	output->tile.hiddenDirty |= tags;
+	TileMarkDirty(output);
+}
+
+void TileMarkAllDirty(mwdServer *server)
+{
+	mwdOutput		*output;
+
+	wl_list_for_each(output, &server->outputs, link) {
+		TileMarkTagsDirty(output, MWD_TAG_ALL);
+	}
+}
+
+void TileSetKind(mwdOutput *output, mwdTileKind kind)
+{
+	if (!output || output->tile.kind == kind) {
+		return;
+	}
+
+	output->tile.kind = kind;
+	TileMarkTagsDirty(output, MWD_TAG_ALL);
+}
+
+/* Scroll the strip of the scrolling layout */
+void TileScroll(mwdOutput *output, double delta)
+{
+	if (!output || output->tile.kind != MWD_TILE_SCROLLING || delta == 0) {
+		return;
+	}
+
+	/* This is clamped to the ends of the strip when it is arranged */
+	output->tile.scroll.offset += delta;
+	TileMarkDirty(output);
+}
+
+/* Scroll the strip so that the whole view is on the output */
+void TileReveal(mwdView *view)
+{
+	mwdOutput		*output;
+	mwdTileBox		area;
+
+	if (!TileIsTiled(view) || (output = view->output)->tile.kind != MWD_TILE_SCROLLING) {
+		return;
+	}
+
+	if (!TileGetArea(output, &area)) {
+		return;
+	}
+
+	if (view->left < area.left) {
+		TileScroll(output, view->left - area.left);
+	} else if (view->right > area.right) {
+		TileScroll(output, view->right - area.right);
+	}
+}
+
+void TileAdjustRatio(mwdOutput *output, double delta)
+{
+	double		ratio;
+
+	if (!output) {
+		return;
+	}
+
+	if (output->tile.kind == MWD_TILE_SCROLLING) {
+		/* The same keys adjust the width of the columns in the scrolling layout */
+		ratio = output->tile.scroll.width + delta;
+		if (ratio < TILE_RATIO_MIN) {
+			ratio = TILE_RATIO_MIN;
+		}
+		if (ratio > 1.0) {
+			ratio = 1.0;
+		}
+
+		if (ratio != output->tile.scroll.width) {
+			output->tile.scroll.width = ratio;
+			TileMarkTagsDirty(output, MWD_TAG_ALL);
+		}
+		return;
+	}
+
+	ratio = output->tile.masterRatio + delta;
+	if (ratio < TILE_RATIO_MIN) {
+		ratio = TILE_RATIO_MIN;
+	}
+	if (ratio > TILE_RATIO_MAX) {
+		ratio = TILE_RATIO_MAX;
+	}
+
+	if (ratio != output->tile.masterRatio) {
+		output->tile.masterRatio = ratio;
+		TileMarkTagsDirty(output, MWD_TAG_ALL);
+	}
+}
+
+void TileAdjustCount(mwdOutput *output, int delta)
+{
+	int			*count;
+
+	if (!output) {
+		return;
+	}
+
+	/* The same keys adjust the number of columns in the m-column layout */
+	count = output->tile.kind == MWD_TILE_COLUMNS ? &output->tile.columns : &output->tile.masterCount;
+
+	if (*count + delta < (output->tile.kind == MWD_TILE_COLUMNS ? 1 : 0)) {
+		return;
+	}
+
+	*count += delta;
+	TileMarkTagsDirty(output, MWD_TAG_ALL);
+}
+
+void TileOutputInit(mwdOutput *output)
+{
+	output->tile.kind			= MWD_TILE_MASTER_STACK;
+	output->tile.masterCount	= 1;
+	output->tile.masterRatio	= 0.55;
+	output->tile.columns		= 3;
+	output->tile.scroll.width	= 0.5;
+	output->tile.scroll.offset	= 0;
+
+	TileMarkTagsDirty(output, MWD_TAG_ALL);
+}
+
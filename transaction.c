@@ -0,0 +1,215 @@
+#include "../mwd.h"
+
+/*
+	Layout transactions
+
+	When a layout change resizes several views at once each client acks and
+	commits its new size at a different time, which would result in frames
+	showing a mix of the old and new layouts.
+
+	Instead all of the configures for a layout change are sent together, and
+	the last buffer of each view is saved and rendered at its old geometry
+	until every view has acked and committed its new state (or the timeout has
+	expired). The whole layout is then applied in a single frame.
+
+	Only one transaction is in flight at a time. Changes made while waiting
+	are added to the in flight transaction, and the timeout is measured from
+	the time it started, so a constant stream of changes can't stall the
+	screen indefinitely.
+*/
+
+#define TRANSACTION_TIMEOUT_MS		200
+
+static void TransactionSave(mwdView *view)
+{
+	struct wlr_surface		*surface;
+	double					top, right, bottom, left;
+
+	if (view->saved.buffer) {
+		/* Keep the oldest buffer if the view was already saved */
+		return;
+	}
+
+	if (!view->mapped || !(surface = ViewGetSurface(view)) || !surface->buffer) {
+		return;
+	}
+
+	ViewGetRenderPos(view, &top, &right, &bottom, &left);
+
+	view->saved.buffer		= surface->buffer;
+	view->saved.top			= top;
+	view->saved.left		= left;
+	view->saved.width		= right - left;
+	view->saved.height		= bottom - top;
+	view->saved.transform	= surface->current.transform;
+
+	wlr_buffer_lock(&view->saved.buffer->base);
+}
+
+static void TransactionRelease(mwdView *view)
+{
+	if (view->saved.buffer) {
+		wlr_buffer_unlock(&view->saved.buffer->base);
+		view->saved.buffer = NULL;
+	}
+}
+
+static void TransactionApply(mwdTransaction *txn)
+{
+	mwdServer			*server	= txn->server;
+	mwdView				*view, *tmp;
+	struct timespec		now;
+
+	wl_list_for_each_safe(view, tmp, &txn->views, transaction.link) {
+		wl_list_remove(&view->transaction.link);
+		view->transaction.txn = NULL;
+
+		TransactionRelease(view);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	HistogramAdd(&server->transaction.hist, StatsElapsed(&txn->start, &now));
+
+	if (server->transaction.active == txn) {
+		server->transaction.active = NULL;
+	}
+
+	wl_event_source_remove(txn->timer);
+	free(txn);
+}
+
+static int TransactionTimeout(void *data)
+{
+	mwdTransaction		*txn = data;
+
+	wlr_log(WLR_DEBUG, "Layout transaction timed out waiting for %d view(s)", txn->waiting);
+	txn->server->transaction.timeouts++;
+
+	TransactionApply(txn);
+	return 0;
+}
+
+/* Return the in flight transaction, or start a new one */
+mwdTransaction *TransactionBegin(mwdServer *server)
+{
+	mwdTransaction			*txn;
+	struct wl_event_loop	*loop;
+
+	if ((txn = server->transaction.active)) {
+		return txn;
+	}
+
+	if (!(txn = calloc(1, sizeof(mwdTransaction)))) {
+		return NULL;
+	}
+
+	loop = wl_display_get_event_loop(server->display);
+	if (!(txn->timer = wl_event_loop_add_timer(loop, TransactionTimeout, txn))) {
+		free(txn);
+		return NULL;
+	}
+
+	txn->server = server;
+	wl_list_init(&txn->views);
+	clock_gettime(CLOCK_MONOTONIC, &txn->start);
+
+	server->transaction.active = txn;
+	return txn;
+}
+
+/*
+	Add a position change for a view to the transaction. The configure is sent
+	immediately, but the view continues to be rendered as it was until the
+	transaction is applied.
+
+	If txn is NULL the position is simply set.
+*/
+void TransactionSetPos(mwdTransaction *txn, mwdView *view, double top, double right, double bottom, double left)
+{
+	bool			wasReady;
+
+	if (!txn) {
+		ViewSetPos(view, top, right, bottom, left);
+		return;
+	}
+
+	TransactionSave(view);
+
+	if (!view->transaction.txn) {
+		view->transaction.txn	= txn;
+		view->transaction.ready	= true;
+		wl_list_insert(txn->views.prev, &view->transaction.link);
+	}
+	wasReady = view->transaction.ready;
+
+	ViewSetPos(view, top, right, bottom, left);
+
+	/* Some changes (ie position only) don't require the client to do anything */
+	view->transaction.ready = ViewIsConfigured(view);
+
+	if (wasReady && !view->transaction.ready) {
+		txn->waiting++;
+	} else if (!wasReady && view->transaction.ready) {
+		txn->waiting--;
+	}
+}
+
+/* Apply the transaction now if nothing is outstanding, or wait for the views */
+void TransactionCommit(mwdTransaction *txn)
+{
+	if (!txn) {
+		return;
+	}
+
+	if (txn->waiting <= 0) {
+		TransactionApply(txn);
+		return;
+	}
+
+	/* The timeout is measured from the start of the transaction */
+	if (!txn->armed) {
+		txn->armed = true;
+		wl_event_source_timer_update(txn->timer, TRANSACTION_TIMEOUT_MS);
+	}
+}
+
+/* A view in a transaction has committed; check if it has caught up */
+void TransactionViewCommitted(mwdView *view)
+{
+	mwdTransaction		*txn = view->transaction.txn;
+
+	if (!txn || view->transaction.ready || !ViewIsConfigured(view)) {
+		return;
+	}
+
+	view->transaction.ready = true;
+	if (--txn->waiting <= 0) {
+		TransactionApply(txn);
+	}
+}
+
+/* The view is going away; it can't hold up the transaction any longer */
+void TransactionRemoveView(mwdView *view)
+{
+	mwdTransaction		*txn = view->transaction.txn;
+
+	TransactionRelease(view);
+
+	if (!txn) {
+		return;
+	}
+
+	wl_list_remove(&view->transaction.link);
+	view->transaction.txn = NULL;
+
+	if (!view->transaction.ready && --txn->waiting <= 0) {
+		TransactionApply(txn);
+	}
+}
+
+void TransactionMain(mwdServer *server)
+{
+	server->transaction.active = NULL;
+	HistogramInit(&server->transaction.hist, "layout transaction duration");
+}
+
@@ -9,6 +9,24 @@ struct wlr_surface *ViewGetSurface(mwdView *view)
 	return view->cb->get.surface(view);
 }
 
+const char *ViewGetAppId(mwdView *view)
+{
+	if (!view || !view->cb || !view->cb->get.appId) {
+		return NULL;
+	}
+
+	return view->cb->get.appId(view);
+}
+
+const char *ViewGetTitle(mwdView *view)
+{
+	if (!view || !view->cb || !view->cb->get.title) {
+		return NULL;
+	}
+
+	return view->cb->get.title(view);
+}
+
 void ViewForEachSurface(mwdView *view, wlr_surface_iterator_func_t iterator, void *user_data)
 {
 	if (!view || !view->cb || !view->cb->foreach.surface) {
@@ -18,40 +36,213 @@ void ViewForEachSurface(mwdView *view, wlr_surface_iterator_func_t iterator, voi
 	return view->cb->foreach.surface(view, iterator, user_data);
 }
 
-void ViewGetPos(mwdView *view, double *top, double *right, double *bottom, double *left)
+static void ViewFrameDone(struct wlr_surface *surface, int sx, int sy, void *data)
+{
+	wlr_surface_send_frame_done(surface, (struct timespec *) data);
+}
+
+/*
+	Send frame callbacks for a view that isn't being rendered normally, so the
+	client isn't left waiting to draw its next frame.
+*/
+void ViewSendFrameDone(mwdView *view)
+{
+	struct timespec		now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ViewForEachSurface(view, ViewFrameDone, &now);
+}
+
+/*
+	The position of a view is needed by rendering, hit-testing, grabs and
+	constraints, often many times per frame, but it only changes when the view
+	commits, is configured or is moved. Cache it, and only compute it through
+	the shell again after one of those has marked it as changed.
+
+	Build with -DMWD_DEBUG_GEOMETRY to check the cache against the shell every
+	time it is read.
+*/
+static void ViewComputePos(mwdView *view, double *top, double *right, double *bottom, double *left)
 {
+	*top	= view->top;
+	*right	= view->right;
+	*bottom	= view->bottom;
+	*left	= view->left;
+
+	if (view->cb && view->cb->get.pos) {
+		view->cb->get.pos(view, top, right, bottom, left);
+	}
+}
+
+static void ViewComputeRenderPos(mwdView *view, double *top, double *right, double *bottom, double *left)
+{
+	if (view->cb && view->cb->get.renderPos) {
+		view->cb->get.renderPos(view, top, right, bottom, left);
+		return;
+	}
+
+	ViewComputePos(view, top, right, bottom, left);
+}
+
+#ifdef MWD_DEBUG_GEOMETRY
+static void ViewCheckBox(mwdView *view, const char *name, mwdTileBox *cached, mwdTileBox *live)
+{
+	if (cached->top != live->top || cached->right != live->right ||
+		cached->bottom != live->bottom || cached->left != live->left
+	) {
+		wlr_log(WLR_ERROR, "Stale %s geometry for %s: cached %.1f,%.1f %.1fx%.1f, live %.1f,%.1f %.1fx%.1f",
+				name, ViewGetAppId(view) ? ViewGetAppId(view) : "(null)",
+				cached->left, cached->top, cached->right - cached->left, cached->bottom - cached->top,
+				live->left, live->top, live->right - live->left, live->bottom - live->top);
+	}
+}
+
+static void ViewCheckGeometry(mwdView *view)
+{
+	mwdTileBox		pos, render;
+
+	ViewComputePos(view, &pos.top, &pos.right, &pos.bottom, &pos.left);
+	ViewComputeRenderPos(view, &render.top, &render.right, &render.bottom, &render.left);
+
+	ViewCheckBox(view, "logical", &view->geometry.pos, &pos);
+	ViewCheckBox(view, "render", &view->geometry.render, &render);
+}
+#endif
+
+static void ViewUpdateGeometry(mwdView *view)
+{
+	mwdTileBox		*pos	= &view->geometry.pos;
+	mwdTileBox		*render	= &view->geometry.render;
+
+	if (view->geometry.valid) {
+#ifdef MWD_DEBUG_GEOMETRY
+		ViewCheckGeometry(view);
+#endif
+		return;
+	}
+
+	ViewComputePos(view, &pos->top, &pos->right, &pos->bottom, &pos->left);
+	ViewComputeRenderPos(view, &render->top, &render->right, &render->bottom, &render->left);
+
+	view->geometry.valid = true;
+}
+
+/*
+	The view has committed, been configured or moved. The bounds in the store
+	are used to decide what to render and hit-test, so they are updated now
+	instead of on the next use.
+*/
+void ViewGeometryChanged(mwdView *view)
+{
+	if (!view) {
+		return;
+	}
+
+	view->geometry.valid = false;
+	ViewUpdateGeometry(view);
+	ViewSyncStore(view);
+}
+
+static void ViewGrowBox(mwdTileBox *box, double top, double right, double bottom, double left)
+{
+	box->top	= top < box->top ? top : box->top;
+	box->right	= right > box->right ? right : box->right;
+	box->bottom	= bottom > box->bottom ? bottom : box->bottom;
+	box->left	= left < box->left ? left : box->left;
+}
+
+/* Copy the fields that traversals need into the view's entry in the store */
+void ViewSyncStore(mwdView *view)
+{
+	mwdViewHot		*hot;
+	mwdTileBox		*bounds;
+
 	if (!view) {
 		return;
 	}
+	hot		= StoreHot(view);
+	bounds	= &hot->bounds;
+
+	hot->surface	= view->mapped ? ViewGetSurface(view) : NULL;
+	hot->layer		= view->renderLayer;
+	hot->seq		= view->seq.draw;
+	hot->unbounded	= ViewIsUnbounded(view);
+
+	if (!view->geometry.valid) {
+		return;
+	}
 
+	/* The surface may be larger than the geometry, ie client side shadows */
+	*bounds = view->geometry.pos;
+	ViewGrowBox(bounds, view->geometry.render.top, view->geometry.render.right,
+			view->geometry.render.bottom, view->geometry.render.left);
+
+	/* A buffer saved by a transaction is drawn where the view used to be */
+	if (view->saved.buffer) {
+		ViewGrowBox(bounds, view->saved.top, view->saved.left + view->saved.width,
+				view->saved.top + view->saved.height, view->saved.left);
+	}
+
+	hot->outputs = OutputMask(view->server, bounds);
+}
+
+/* Sync every view, ie when the outputs have moved */
+void ViewSyncStoreAll(mwdServer *server)
+{
+	mwdStore		*store	= &server->views.store;
+
+	for (uint32_t i = 0; i < store->used; i++) {
+		if (store->hot[i].view) {
+			ViewSyncStore(store->hot[i].view);
+		}
+	}
+}
+
+static void ViewCopyBox(mwdTileBox *box, double *top, double *right, double *bottom, double *left)
+{
 	if (top) {
-		*top	= view->top;
+		*top	= box->top;
 	}
 	if (right) {
-		*right	= view->right;
+		*right	= box->right;
 	}
 	if (bottom) {
-		*bottom	= view->bottom;
+		*bottom	= box->bottom;
 	}
 	if (left) {
-		*left	= view->left;
+		*left	= box->left;
 	}
+}
 
-	if (!view->cb || !view->cb->get.pos) {
+void ViewGetPos(mwdView *view, double *top, double *right, double *bottom, double *left)
+{
+	if (!view) {
 		return;
 	}
 
-	view->cb->get.pos(view, top, right, bottom, left);
+	ViewUpdateGeometry(view);
+	ViewCopyBox(&view->geometry.pos, top, right, bottom, left);
 }
 
 void ViewGetRenderPos(mwdView *view, double *top, double *right, double *bottom, double *left)
 {
-	if (view && view->cb && view->cb->get.renderPos) {
-		view->cb->get.renderPos(view, top, right, bottom, left);
+	if (!view) {
+		return;
+	}
+
+	ViewUpdateGeometry(view);
+	ViewCopyBox(&view->geometry.render, top, right, bottom, left);
+}
+
+/* Set the edges the view is anchored by when its size doesn't match its position */
+void ViewSetEdges(mwdView *view, uint32_t edges)
+{
+	if (!view || view->edges == edges) {
 		return;
 	}
 
-	ViewGetPos(view, top, right, bottom, left);
+	view->edges = edges;
+	ViewGeometryChanged(view);
 }
 
 void ViewGetSize(mwdView *view, double *width, double *height)
@@ -107,6 +298,15 @@ void ViewFocus(mwdView *view, bool raise)
 		*/
 		wl_list_remove(&view->link.drawOrder);
 		wl_list_insert(&server->views.drawOrder, &view->link.drawOrder);
+		TagRaise(view);
+
+		/*
+			A view that is scrolled off of its output is scrolled into view.
+
+			This is not done when focus follows the pointer, because hovering
+			over the edge of a neighbouring column would scroll the strip.
+		*/
+		TileReveal(view);
 	}
 
 	surface = ViewGetSurface(view);
@@ -128,6 +328,9 @@ void ViewFocus(mwdView *view, bool raise)
 		wlr_seat_keyboard_notify_enter(seat, surface, keyboard->keycodes, keyboard->num_keycodes, &keyboard->modifiers);
 	}
 
+	/* A pointer constraint is only active while the surface has focus */
+	ConstraintFocus(server, surface);
+
 #if 1
 	{
 		double						top, right, bottom, left;
@@ -151,6 +354,9 @@ mwdView *ViewFocused(mwdServer *server)
 	The ViewNext and ViewPrev calls are swapped because the userOrder list is
 	actually backwards, since it is easier to insert at the start of a list than
 	it is to append to the end.
+
+	Only visible views are included. If the view isn't visible then the first
+	visible view is returned.
 */
 mwdView *ViewPrev(mwdView *view)
 {
@@ -162,13 +368,22 @@ mwdView *ViewPrev(mwdView *view)
 	}
 	server = view->server;
 
-	next = view->link.userOrder.next;
-	if (next == &server->views.userOrder) {
+	if (wl_list_empty(&server->views.visible.userOrder)) {
+		return NULL;
+	}
+
+	if (!view->visible || view->type == MWD_LAYER_SHELL) {
+		next = server->views.visible.userOrder.next;
+	} else {
+		next = view->link.visible.userOrder.next;
+	}
+
+	if (next == &server->views.visible.userOrder) {
 		/* We are on the last item, wrap */
-		next = server->views.userOrder.next;
+		next = server->views.visible.userOrder.next;
 	}
 
-	view = wl_container_of(next, view, link.userOrder);
+	view = wl_container_of(next, view, link.visible.userOrder);
 	return view;
 }
 
@@ -182,13 +397,22 @@ mwdView *ViewNext(mwdView *view)
 	}
 	server = view->server;
 
-	prev = view->link.userOrder.prev;
-	if (prev == &server->views.userOrder) {
+	if (wl_list_empty(&server->views.visible.userOrder)) {
+		return NULL;
+	}
+
+	if (!view->visible || view->type == MWD_LAYER_SHELL) {
+		prev = server->views.visible.userOrder.next;
+	} else {
+		prev = view->link.visible.userOrder.prev;
+	}
+
+	if (prev == &server->views.visible.userOrder) {
 		/* We are on the last item, wrap */
-		prev = server->views.userOrder.prev;
+		prev = server->views.visible.userOrder.prev;
 	}
 
-	view = wl_container_of(prev, view, link.userOrder);
+	view = wl_container_of(prev, view, link.visible.userOrder);
 	return view;
 }
 
@@ -199,6 +423,7 @@ void ViewGrab(mwdView *view, mwdGrabMode mode, uint32_t edges)
 	server->grab.view		= view;
 	server->grab.mode		= mode;
 	server->grab.edges		= edges;
+	server->grab.moved		= false;
 
 	/* Get the initial position of the view */
 	ViewGetPos(view, &server->grab.top, &server->grab.right, &server->grab.bottom, &server->grab.left);
@@ -208,19 +433,85 @@ void ViewGrab(mwdView *view, mwdGrabMode mode, uint32_t edges)
 	server->grab.cursor.y	= server->cursor->y;
 }
 
+/* How far, in layout pixels, the cursor has to move before a grab takes effect */
+#define VIEW_GRAB_THRESHOLD		4
+
+/*
+	Returns true once the cursor has moved far enough from where the grab
+	started to be a real move or resize. A click that only meant to focus, or
+	a client that asks to be moved on every button press, doesn't get that
+	far, so the view is left alone.
+*/
+bool ViewGrabMotion(mwdServer *server)
+{
+	mwdView					*view	= server->grab.view;
+	double					x		= server->cursor->x - server->grab.cursor.x;
+	double					y		= server->cursor->y - server->grab.cursor.y;
+
+	if (server->grab.moved) {
+		return true;
+	}
+
+	if (x * x + y * y < VIEW_GRAB_THRESHOLD * VIEW_GRAB_THRESHOLD) {
+		return false;
+	}
+	server->grab.moved = true;
+
+	if (TileIsTiled(view)) {
+		/*
+			Moving or resizing a view with the mouse takes it out of the
+			layout, and the remaining views fill the space it leaves.
+		*/
+		view->floating = true;
+		TileMarkTagsDirty(view->output, view->tags);
+	}
+	return true;
+}
+
 mwdView *ViewFindByPos(mwdServer *server, double x, double y, struct wlr_surface **psurface, double *offsetX, double *offsetY)
 {
 	/*
-		Look through all of the views and attempt to find one under the cursor.
-		This relies on server->views being top to bottom.
+		Find the top most view under the cursor. Only the views that are drawn
+		are in the visible draw order list, which is top first. The bounds in
+		the store rule out most of them without touching the view, and the rest
+		are asked if they accept the point until one does.
 	*/
 	mwdView					*view;
+	mwdViewHot				*hot;
+	struct wlr_surface		*surface;
 
 	if (psurface) {
 		*psurface = NULL;
 	}
 
-	wl_list_for_each(view, &server->views.drawOrder, link.drawOrder) {
+	/*
+		Override-redirect X11 surfaces are above every view. They aren't views,
+		so the surface is returned without one; the pointer can enter it but it
+		can't take focus.
+	*/
+	if ((surface = XWaylandUnmanagedAt(server, x, y, offsetX, offsetY))) {
+		if (psurface) {
+			*psurface = surface;
+		}
+		return NULL;
+	}
+
+	wl_list_for_each(view, &server->views.visible.drawOrder, link.visible.drawOrder) {
+		hot = StoreHot(view);
+
+		/* Nothing is shown on outputs that are powered off */
+		if (hot->outputs && !(hot->outputs & server->output.powered)) {
+			continue;
+		}
+
+		/* Unbounded views (ie with popups) have to be asked every time */
+		if (!hot->unbounded && (
+			x < hot->bounds.left || x >= hot->bounds.right ||
+			y < hot->bounds.top || y >= hot->bounds.bottom)
+		) {
+			continue;
+		}
+
 		if (view->cb && view->cb->is.at &&
 			view->cb->is.at(view, x, y, psurface, offsetX, offsetY)
 		) {
@@ -232,15 +523,16 @@ mwdView *ViewFindByPos(mwdServer *server, double x, double y, struct wlr_surface
 
 mwdView *ViewFindBySurface(mwdServer *server, struct wlr_surface *surface)
 {
-	/*
-		Look through all of the views and attempt to find one under the cursor.
-		This relies on server->views being top to bottom.
-	*/
-	mwdView		*view;
+	/* Only mapped views have a surface in the store */
+	mwdStore		*store	= &server->views.store;
 
-	wl_list_for_each(view, &server->views.drawOrder, link.drawOrder) {
-		if (surface == ViewGetSurface(view)) {
-			return view;
+	if (!surface) {
+		return NULL;
+	}
+
+	for (uint32_t i = 0; i < store->used; i++) {
+		if (store->hot[i].surface == surface) {
+			return store->hot[i].view;
 		}
 	}
 	return NULL;
@@ -296,12 +588,72 @@ void ViewSetPos(mwdView *view, double top, double right, double bottom, double l
 	}
 
 	view->cb->set.pos(view, top, right, bottom, left);
+	ViewGeometryChanged(view);
+}
+
+/* Send any changes to the client that are being held back, ie at the end of a grab */
+void ViewFlush(mwdView *view)
+{
+	if (!view || !view->cb || !view->cb->flush) {
+		return;
+	}
+
+	view->cb->flush(view);
+}
+
+static void commit(struct wl_listener *listener, void *data)
+{
+	struct mwdView *view = wl_container_of(listener, view, commit);
+
+	LatencyCommit(view);
+
+	if (view->cb && view->cb->commit) {
+		view->cb->commit(view);
+	}
+	ViewGeometryChanged(view);
+
+	TransactionViewCommitted(view);
 }
 
 static void map(struct wl_listener *listener, void *data)
 {
-	struct mwdView *view = wl_container_of(listener, view, map);
+	struct mwdView		*view = wl_container_of(listener, view, map);
+	struct wlr_surface	*surface;
+
 	view->mapped = true;
+	ViewGeometryChanged(view);
+
+	if ((surface = ViewGetSurface(view))) {
+		wl_signal_add(&surface->events.commit, &view->commit);
+	}
+
+	/* The app_id is known by now, so lookup (or compile) the remap table once */
+	view->remap = RemapFind(view->server, ViewGetAppId(view));
+	if (surface && surface == view->server->seat->keyboard_state.focused_surface) {
+		RemapFocus(view->server, surface);
+	}
+
+	/* New views are placed on the output with the cursor */
+	if (!view->output) {
+		view->output = OutputAt(view->server, view->server->cursor->x, view->server->cursor->y);
+	}
+
+	/* The window rules have the final say, if any of them matched */
+	RulesEvaluate(view);
+
+	if (view->rules.result.tags) {
+		view->tags = view->rules.result.tags;
+	}
+	if (view->rules.result.floating >= 0) {
+		view->floating = view->rules.result.floating;
+	}
+
+	/* otherwise it goes on the tags that are selected on that output */
+	if (!view->tags) {
+		view->tags = view->output ? view->output->tag.selected : 1;
+	}
+	TagLink(view);
+	TileMarkTagsDirty(view->output, view->tags);
 
 	// TODO Don't always focus a new view! Don't allow stealing focus!
 	ViewFocus(view, true);
@@ -315,7 +667,25 @@ static void unmap(struct wl_listener *listener, void *data)
 		ViewFocus(ViewPrev(view), true);
 	}
 
+	if (view->commit.link.next) {
+		wl_list_remove(&view->commit.link);
+		wl_list_init(&view->commit.link);
+	}
+	view->latency.input		= 0;
+	view->latency.committed	= 0;
+
 	view->mapped = false;
+	view->culled = false;
+	TagUnlink(view);
+	TransactionRemoveView(view);
+
+	if (view->server->grab.view == view) {
+		view->server->grab.view = NULL;
+		view->server->grab.mode = MWD_GRAB_NONE;
+	}
+
+	/* Let the remaining views fill the space */
+	TileMarkTagsDirty(view->output, view->tags);
 }
 
 bool ViewIsValid(mwdView *view)
@@ -344,6 +714,29 @@ bool ViewIsVisible(mwdView *view, mwdOutput *output)
 	return view->cb->is.visible(view, output);
 }
 
+/*
+	Returns true if the view has caught up with every configure it has been
+	sent. Shells that can't tell are always considered configured.
+*/
+bool ViewIsConfigured(mwdView *view)
+{
+	if (!view || !view->cb || !view->cb->is.configured) {
+		return true;
+	}
+
+	return view->cb->is.configured(view);
+}
+
+/* Returns true if the view may have surfaces outside of its position */
+bool ViewIsUnbounded(mwdView *view)
+{
+	if (!view || !view->cb || !view->cb->is.unbounded) {
+		return false;
+	}
+
+	return view->cb->is.unbounded(view);
+}
+
 static void destroy(struct wl_listener *listener, void *data)
 {
 	struct mwdView	*view		= wl_container_of(listener, view, destroy);
@@ -352,6 +745,8 @@ static void destroy(struct wl_listener *listener, void *data)
 		return;
 	}
 
+	TagUnlink(view);
+	RulesViewDestroy(view);
 	view->cb->destroy(view);
 }
 
@@ -388,7 +783,12 @@ void RenderView(mwdView *view, struct wlr_renderer *renderer, mwdOutput *output)
 		return;
 	}
 
-	if (view->cb->render) {
+	LatencyRender(view, output);
+
+	if (view->saved.buffer) {
+		/* A transaction is in flight; keep showing the old state */
+		RenderSaved(view, renderer, output);
+	} else if (view->cb->render) {
 		view->cb->render(view, renderer, output);
 	} else if (view->cb->get.surface && (surface = view->cb->get.surface(view))) {
 		/*
@@ -411,13 +811,16 @@ mwdView *CreateNewView(mwdServer *server)
 	struct mwdView			*view;
 
 	/* Allocate our own view structure for this surface */
-	if (!(view = calloc(1, sizeof(struct mwdView)))) {
+	if (!(view = StoreAlloc(server))) {
 		return NULL;
 	}
 	view->type			= MWD_UNKNOWN;
 	view->server		= server;
 	view->renderLayer	= MWD_LAYER_NORMAL;
 
+	TagViewInit(view);
+	RulesViewInit(view);
+
 	/* Initially we are positioning this view from the top left */
 	view->edges			= WLR_EDGE_TOP | WLR_EDGE_LEFT;
 
@@ -426,6 +829,7 @@ mwdView *CreateNewView(mwdServer *server)
 	view->unmap.notify			= unmap;
 	view->destroy.notify		= destroy;
 	view->requestMove.notify	= requestMove;
+	view->commit.notify			= commit;
 
 	return view;
 }
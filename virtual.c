@@ -0,0 +1,241 @@
+#include "../mwd.h"
+#include <signal.h>
+#include <wlr/backend/headless.h>
+#include <wlr/backend/multi.h>
+
+/*
+	Virtual outputs
+
+	Virtual outputs are headless outputs, created alongside the real outputs
+	for screen sharing and for testing. They are listed in a file, given with
+	-V, which is read at startup and again on SIGHUP. Each line is:
+
+		<name> <width>x<height>[@<refresh in Hz>]
+
+	For example:
+		share 1920x1080@30
+
+	Outputs are added and removed, or have their mode changed, to match the
+	file. They go through OutputAdd like any other output, so they are part of
+	the layout and are rendered by RenderFrame, but only while a screencopy
+	client is waiting on a frame from them since otherwise nobody would ever
+	see the result.
+*/
+
+#define VIRTUAL_LINE_MAX		256
+
+static mwdVirtual *VirtualFind(mwdServer *server, const char *name)
+{
+	mwdVirtual		*virt;
+
+	wl_list_for_each(virt, &server->virtuals.list, link) {
+		if (!strcmp(virt->name, name)) {
+			return virt;
+		}
+	}
+	return NULL;
+}
+
+static void VirtualFree(mwdVirtual *virt)
+{
+	wl_list_remove(&virt->link);
+	wl_list_remove(&virt->destroy.link);
+	free(virt->name);
+	free(virt);
+}
+
+static void VirtualOutputDestroy(struct wl_listener *listener, void *data)
+{
+	mwdVirtual		*virt = wl_container_of(listener, virt, destroy);
+
+	VirtualFree(virt);
+}
+
+/* Apply the mode; headless outputs take any size and refresh rate */
+static void VirtualSetMode(mwdVirtual *virt)
+{
+	wlr_output_enable(virt->output, true);
+	wlr_output_set_custom_mode(virt->output, virt->width, virt->height, virt->refresh);
+
+	if (!wlr_output_commit(virt->output)) {
+		wlr_log(WLR_ERROR, "Failed to set the mode of virtual output %s", virt->name);
+	}
+}
+
+static void VirtualAdd(mwdServer *server, const char *name, int width, int height, int refresh)
+{
+	mwdVirtual		*virt;
+
+	if (!(virt = calloc(1, sizeof(mwdVirtual))) || !(virt->name = strdup(name))) {
+		wlr_log(WLR_ERROR, "Failed to allocate virtual output %s", name);
+		free(virt);
+		return;
+	}
+	virt->server	= server;
+	virt->width		= width;
+	virt->height	= height;
+	virt->refresh	= refresh;
+	virt->seen		= true;
+
+	/* OutputAdd is called from within wlr_headless_add_output */
+	server->virtuals.adding = true;
+	virt->output = wlr_headless_add_output(server->virtuals.backend, width, height);
+	server->virtuals.adding = false;
+
+	if (!virt->output) {
+		wlr_log(WLR_ERROR, "Failed to create virtual output %s", name);
+		free(virt->name);
+		free(virt);
+		return;
+	}
+
+	virt->destroy.notify = VirtualOutputDestroy;
+	wl_signal_add(&virt->output->events.destroy, &virt->destroy);
+	wl_list_insert(server->virtuals.list.prev, &virt->link);
+
+	VirtualSetMode(virt);
+	wlr_log(WLR_INFO, "Added virtual output %s (%s) %dx%d@%dmHz", name, virt->output->name, width, height, refresh);
+}
+
+/* Read the file, and add, change or remove virtual outputs to match it */
+static void VirtualLoad(mwdServer *server)
+{
+	FILE			*file;
+	char			line[VIRTUAL_LINE_MAX];
+	char			name[VIRTUAL_LINE_MAX];
+	mwdVirtual		*virt, *tmp;
+	int				width, height, n;
+	double			hz;
+	int				refresh;
+
+	if (!server->virtuals.path || !server->virtuals.backend) {
+		return;
+	}
+
+	if (!(file = fopen(server->virtuals.path, "r"))) {
+		wlr_log_errno(WLR_ERROR, "Failed to open %s", server->virtuals.path);
+		return;
+	}
+
+	wl_list_for_each(virt, &server->virtuals.list, link) {
+		virt->seen = false;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		line[strcspn(line, "#\n")] = '\0';
+
+		if ((n = sscanf(line, "%255s %dx%d@%lf", name, &width, &height, &hz)) < 1) {
+			/* Blank line */
+			continue;
+		}
+
+		if (n < 3 || width <= 0 || height <= 0 || (n == 4 && hz <= 0)) {
+			wlr_log(WLR_ERROR, "Ignoring invalid virtual output in %s: %s", server->virtuals.path, line);
+			continue;
+		}
+
+		/* The headless backend uses 60Hz if the refresh rate is 0 */
+		refresh = n == 4 ? (int) (hz * 1000) : 0;
+
+		if (!(virt = VirtualFind(server, name))) {
+			VirtualAdd(server, name, width, height, refresh);
+			continue;
+		}
+		virt->seen = true;
+
+		if (virt->width != width || virt->height != height || virt->refresh != refresh) {
+			virt->width		= width;
+			virt->height	= height;
+			virt->refresh	= refresh;
+			VirtualSetMode(virt);
+		}
+	}
+	fclose(file);
+
+	wl_list_for_each_safe(virt, tmp, &server->virtuals.list, link) {
+		if (!virt->seen) {
+			wlr_log(WLR_INFO, "Removing virtual output %s", virt->name);
+
+			/* This frees virt, through VirtualOutputDestroy */
+			wlr_output_destroy(virt->output);
+		}
+	}
+}
+
+static int VirtualSignal(int signal, void *data)
+{
+	VirtualLoad((mwdServer *) data);
+	return 0;
+}
+
+static void VirtualIdle(void *data)
+{
+	VirtualLoad((mwdServer *) data);
+}
+
+/*
+	Returns true if anyone is waiting on a frame from the output. Real outputs
+	always have someone looking at them.
+*/
+bool VirtualIsConsumed(mwdOutput *output)
+{
+	struct wlr_screencopy_manager_v1	*screencopy = output->server->output.screencopy;
+	struct wlr_screencopy_frame_v1		*frame;
+
+	if (!output->isVirtual) {
+		return true;
+	}
+
+	if (!screencopy) {
+		return false;
+	}
+
+	wl_list_for_each(frame, &screencopy->frames, link) {
+		/* A frame has a buffer once the client has asked for the copy */
+		if (frame->output == output->output && (frame->shm_buffer || frame->dma_buffer)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool VirtualSetPath(mwdServer *server, const char *path)
+{
+	free(server->virtuals.path);
+	return (server->virtuals.path = strdup(path)) != NULL;
+}
+
+/*
+	Create the headless backend for the virtual outputs. This must be called
+	before the backend is started; the file is read once the event loop runs.
+*/
+void VirtualMain(mwdServer *server)
+{
+	struct wl_event_loop	*loop = wl_display_get_event_loop(server->display);
+
+	wl_list_init(&server->virtuals.list);
+	server->virtuals.adding = false;
+
+	if (!server->virtuals.path) {
+		return;
+	}
+
+	if (wlr_backend_is_headless(server->backend)) {
+		/* ie when replaying */
+		server->virtuals.backend = server->backend;
+	} else if (wlr_backend_is_multi(server->backend) &&
+		(server->virtuals.backend = wlr_headless_backend_create_with_renderer(server->display, server->renderer)) &&
+		!wlr_multi_backend_add(server->backend, server->virtuals.backend)
+	) {
+		wlr_backend_destroy(server->virtuals.backend);
+		server->virtuals.backend = NULL;
+	}
+
+	if (!server->virtuals.backend) {
+		wlr_log(WLR_ERROR, "Failed to create the backend for virtual outputs");
+		return;
+	}
+
+	server->virtuals.signal = wl_event_loop_add_signal(loop, SIGHUP, VirtualSignal, server);
+	wl_event_loop_add_idle(loop, VirtualIdle, server);
+}
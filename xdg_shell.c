@@ -67,6 +67,25 @@ static bool XdgIsVisible(mwdView *view, mwdOutput *output)
 	return true;
 }
 
+static bool XdgIsFloating(mwdView *view)
+{
+	struct wlr_xdg_toplevel_state	*state;
+
+	if (!XdgIsValid(view)) {
+		return false;
+	}
+
+	/* Dialogs float */
+	if (view->xdg.surface->toplevel->parent) {
+		return true;
+	}
+
+	/* So do views that can't be resized */
+	state = &view->xdg.surface->toplevel->current;
+	return state->min_width != 0 && state->min_height != 0 &&
+		state->min_width == state->max_width && state->min_height == state->max_height;
+}
+
 static void XdgSetPos(mwdView *view, double top, double right, double bottom, double left)
 {
     struct wlr_box		box;
@@ -85,10 +104,58 @@ static void XdgSetPos(mwdView *view, double top, double right, double bottom, do
 	view->bottom	= bottom;
 	view->left		= left;
 
+	if (view->xdg.configureSerial) {
+		/*
+			The client hasn't caught up with the last size it was sent yet.
+			Save this size and send it when the client acks, instead of
+			flooding it with configures it can't keep up with. The old buffer
+			continues to be rendered anchored by view->edges until then.
+		*/
+		if (width != view->xdg.width || height != view->xdg.height) {
+			view->xdg.deferred = true;
+		}
+		return;
+	}
+
     wlr_xdg_surface_get_geometry(view->xdg.surface, &box);
 
 	if (height != box.height || width != box.width) {
-		wlr_xdg_toplevel_set_size(view->xdg.surface, width, height);
+		view->xdg.width				= width;
+		view->xdg.height			= height;
+		view->xdg.configureSerial	= wlr_xdg_toplevel_set_size(view->xdg.surface, width, height);
+	}
+}
+
+static bool XdgIsConfigured(mwdView *view)
+{
+	if (!XdgIsValid(view)) {
+		return true;
+	}
+
+	/* configureSerial is cleared by the first commit after the ack */
+	return !view->xdg.configureSerial && !view->xdg.deferred;
+}
+
+static void XdgCommit(mwdView *view)
+{
+	uint32_t			acked;
+
+	if (!XdgIsValid(view) || !view->xdg.configureSerial) {
+		return;
+	}
+
+	/* Serials may wrap, so compare the difference */
+	acked = view->xdg.surface->configure_serial;
+	if ((int32_t) (acked - view->xdg.configureSerial) < 0) {
+		return;
+	}
+	view->xdg.configureSerial = 0;
+
+	if (view->xdg.deferred) {
+		/* Send the latest requested size */
+		view->xdg.deferred = false;
+
+		XdgSetPos(view, view->top, view->right, view->bottom, view->left);
 	}
 }
 
@@ -133,12 +200,21 @@ void XdgGetPos(mwdView *view, double *ptop, double *pright, double *pbottom, dou
 	}
 }
 
+/*
+	The surface's origin is offset from its window geometry by anything the
+	client draws outside of it, ie client side shadows.
+*/
 void XdgGetRenderPos(mwdView *view, double *ptop, double *pright, double *pbottom, double *pleft)
 {
+    struct wlr_box		box;
 	double				top, right, bottom, left;
 
 	XdgGetPos(view, &top, &right, &bottom, &left);
 
+    wlr_xdg_surface_get_geometry(view->xdg.surface, &box);
+	top		-= box.y;
+	left	-= box.x;
+
 	right	= left + view->xdg.surface->surface->current.width;
 	bottom	= top  + view->xdg.surface->surface->current.height;
 
@@ -156,6 +232,23 @@ void XdgGetRenderPos(mwdView *view, double *ptop, double *pright, double *pbotto
 	}
 }
 
+/* Popups are placed by the client, and may be outside of the view */
+static bool XdgIsUnbounded(mwdView *view)
+{
+	if (!XdgIsValid(view)) {
+		return false;
+	}
+
+	return !wl_list_empty(&view->xdg.surface->popups);
+}
+
+static void XdgNewPopup(struct wl_listener *listener, void *data)
+{
+	mwdView			*view	= wl_container_of(listener, view, xdg.newPopup);
+
+	ViewSyncStore(view);
+}
+
 static bool XdgIsAt(mwdView *view, double x, double y, struct wlr_surface **psurface, double *offsetX, double *offsetY)
 {
 	struct wlr_surface		*surface;
@@ -166,7 +259,7 @@ static bool XdgIsAt(mwdView *view, double x, double y, struct wlr_surface **psur
 		return false;
 	}
 
-	XdgGetPos(view, &top, &right, &bottom, &left);
+	ViewGetRenderPos(view, &top, &right, &bottom, &left);
 
 	/* This expects and returns surface local coordinates */
 	if (!(surface = wlr_xdg_surface_surface_at(view->xdg.surface, x - left, y - top, &offX, &offY))) {
@@ -214,6 +307,24 @@ static struct wlr_surface *XdgGetSurface(mwdView *view)
 	return view->xdg.surface->surface;
 }
 
+static const char *XdgGetAppId(mwdView *view)
+{
+	if (!XdgIsValid(view)) {
+		return NULL;
+	}
+
+	return view->xdg.surface->toplevel->app_id;
+}
+
+static const char *XdgGetTitle(mwdView *view)
+{
+	if (!XdgIsValid(view)) {
+		return NULL;
+	}
+
+	return view->xdg.surface->toplevel->title;
+}
+
 static void XdgDestroyView(mwdView *view)
 {
 	if (!XdgIsValid(view)) {
@@ -223,8 +334,10 @@ static void XdgDestroyView(mwdView *view)
 	wl_list_remove(&view->link.drawOrder);
 	wl_list_remove(&view->link.userOrder);
 
+	wl_list_remove(&view->xdg.newPopup.link);
+
 	view->type = MWD_UNKNOWN;
-	free(view);
+	StoreFree(view);
 }
 
 static void XdgEachSurface(mwdView *view, wlr_surface_iterator_func_t iterator, void *user_data)
@@ -264,6 +377,8 @@ struct mwdViewInterface XdgShellViewInterface = {
 
 	.get = {
 		.surface		= &XdgGetSurface,
+		.appId			= &XdgGetAppId,
+		.title			= &XdgGetTitle,
 		.constraints	= &XdgGetConstraints,
 		.pos			= &XdgGetPos,
 		.renderPos		= &XdgGetRenderPos,
@@ -273,13 +388,17 @@ struct mwdViewInterface XdgShellViewInterface = {
 	.is = {
 		.valid			= &XdgIsValid,
 		.at				= &XdgIsAt,
-		.visible		= &XdgIsVisible
+		.visible		= &XdgIsVisible,
+		.floating		= &XdgIsFloating,
+		.configured		= &XdgIsConfigured,
+		.unbounded		= &XdgIsUnbounded
 	},
 
 	.foreach = {
 		.surface		= &XdgEachSurface
 	},
 
+	.commit				= &XdgCommit,
 	.destroy			= &XdgDestroyView,
 	.render				= &XdgRenderView
 };
@@ -308,18 +427,24 @@ static void XdgNewSurface(struct wl_listener *listener, void *data)
 
 	/* Listen to the various events it can emit */
 	view->requestResize.notify	= XdgRequestResize;
+	view->xdg.newPopup.notify	= XdgNewPopup;
 
 	wl_signal_add(&surface->events.map,						&view->map);
 	wl_signal_add(&surface->events.unmap,					&view->unmap);
 	wl_signal_add(&surface->events.destroy,					&view->destroy);
+	wl_signal_add(&surface->events.new_popup,				&view->xdg.newPopup);
 
 	wl_signal_add(&surface->toplevel->events.request_move,	&view->requestMove);
 	wl_signal_add(&surface->toplevel->events.request_resize,&view->requestResize);
+	wl_signal_add(&surface->toplevel->events.set_title,		&view->rules.setTitle);
+	wl_signal_add(&surface->toplevel->events.set_app_id,	&view->rules.setAppId);
 
 
 	/* Add it to the list of views */
 	wl_list_insert(&server->views.drawOrder, &view->link.drawOrder);
 	wl_list_insert(&server->views.userOrder, &view->link.userOrder);
+
+	RulesEvaluate(view);
 }
 
 void XdgMain(mwdServer *server)
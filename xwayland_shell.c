@@ -1,4 +1,7 @@
 #include "../mwd.h"
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 static bool XWaylandIsValid(mwdView *view)
 {
@@ -8,6 +11,90 @@ static bool XWaylandIsValid(mwdView *view)
 	return true;
 }
 
+/*
+	Find when a process was started, as a CLOCK_MONOTONIC time. The start time
+	in /proc is in clock ticks since boot.
+*/
+static bool XWaylandProcessStart(pid_t pid, struct timespec *start)
+{
+	char					path[64];
+	char					buf[1024];
+	char					*p;
+	unsigned long long		ticks	= 0;
+	struct timespec			boot, now;
+	uint64_t				usec;
+	FILE					*f;
+	size_t					len;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+	if (!(f = fopen(path, "r"))) {
+		return false;
+	}
+	len = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[len] = '\0';
+
+	/* The command may contain spaces, so start counting after it; starttime is field 22 */
+	if (!(p = strrchr(buf, ')')) || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu", &ticks) != 1) {
+		return false;
+	}
+
+	clock_gettime(CLOCK_BOOTTIME, &boot);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	usec = ticks * 1000000 / sysconf(_SC_CLK_TCK);
+	usec = (uint64_t) boot.tv_sec * 1000000 + boot.tv_nsec / 1000 - usec;
+
+	/* usec is now how long ago the process started */
+	start->tv_sec	= now.tv_sec - usec / 1000000;
+	start->tv_nsec	= now.tv_nsec - (usec % 1000000) * 1000;
+	if (start->tv_nsec < 0) {
+		start->tv_sec--;
+		start->tv_nsec += 1000000000;
+	}
+	return true;
+}
+
+/*
+	Record how long the first window of each Xwayland instance took to show
+	up, measured from when its client was started. A cold window had to wait
+	for Xwayland to start, and a warm window didn't.
+*/
+static void XWaylandFirstWindow(mwdServer *server, struct wlr_xwayland_surface *surface)
+{
+	struct timespec			start, now;
+
+	if (server->xwayland.measured) {
+		return;
+	}
+	server->xwayland.measured = true;
+
+	/* Without _NET_WM_PID there is nothing to measure from */
+	if (!surface->pid || !XWaylandProcessStart(surface->pid, &start)) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	HistogramAdd(server->xwayland.warm ? &server->xwayland.warmHist : &server->xwayland.coldHist,
+			StatsElapsed(&start, &now));
+}
+
+static void XWaylandSurfaceAdded(mwdServer *server)
+{
+	if (!server->xwayland.surfaces++) {
+		if (server->xwayland.idleTimer) {
+			wl_event_source_timer_update(server->xwayland.idleTimer, 0);
+		}
+	}
+}
+
+static void XWaylandSurfaceRemoved(mwdServer *server)
+{
+	if (!--server->xwayland.surfaces && server->xwayland.idleTimer) {
+		wl_event_source_timer_update(server->xwayland.idleTimer, server->xwayland.idleSecs * 1000);
+	}
+}
+
 static struct wlr_surface *XWaylandGetSurface(mwdView *view)
 {
 	if (!XWaylandIsValid(view)) {
@@ -17,6 +104,25 @@ static struct wlr_surface *XWaylandGetSurface(mwdView *view)
 	return view->xwayland.surface->surface;
 }
 
+static const char *XWaylandGetAppId(mwdView *view)
+{
+	if (!XWaylandIsValid(view)) {
+		return NULL;
+	}
+
+	/* The X11 class is the closest match to an app_id */
+	return view->xwayland.surface->class;
+}
+
+static const char *XWaylandGetTitle(mwdView *view)
+{
+	if (!XWaylandIsValid(view)) {
+		return NULL;
+	}
+
+	return view->xwayland.surface->title;
+}
+
 static void XWaylandDestroyView(mwdView *view)
 {
 	if (!XWaylandIsValid(view)) {
@@ -25,9 +131,12 @@ static void XWaylandDestroyView(mwdView *view)
 
 	wl_list_remove(&view->link.drawOrder);
 	wl_list_remove(&view->link.userOrder);
+	wl_list_remove(&view->xwayland.pendingLink);
+
+	XWaylandSurfaceRemoved(view->server);
 
 	view->type = MWD_UNKNOWN;
-	free(view);
+	StoreFree(view);
 }
 
 static void XWaylandEachSurface(mwdView *view, wlr_surface_iterator_func_t iterator, void *user_data)
@@ -41,6 +150,65 @@ static void XWaylandEachSurface(mwdView *view, wlr_surface_iterator_func_t itera
 	}
 }
 
+/* Send the configure for the latest position, if there is one waiting */
+static void XWaylandFlush(mwdView *view)
+{
+	double				width, height;
+
+	if (!XWaylandIsValid(view) || !view->xwayland.configurePending) {
+		return;
+	}
+
+	view->xwayland.configurePending = false;
+	wl_list_remove(&view->xwayland.pendingLink);
+	wl_list_init(&view->xwayland.pendingLink);
+
+	width	= view->right - view->left;
+	height	= view->bottom - view->top;
+
+	if (width != view->xwayland.surface->width || height != view->xwayland.surface->height) {
+		/* X11 has no ack, so a commit after the configure is the best we get */
+		view->xwayland.awaitingCommit = true;
+	}
+
+    wlr_xwayland_surface_configure(view->xwayland.surface, view->left, view->top, width, height);
+
+	/* The surface's size is updated by the configure */
+	ViewGeometryChanged(view);
+}
+
+/* Called before rendering each output frame, or when idle if there are none */
+void XWaylandFlushConfigures(mwdServer *server)
+{
+	mwdView				*view, *tmp;
+
+	wl_list_for_each_safe(view, tmp, &server->xwayland.pending, xwayland.pendingLink) {
+		XWaylandFlush(view);
+	}
+}
+
+static void XWaylandFlushIdle(void *data)
+{
+	mwdServer			*server = data;
+
+	/* Idle sources are removed once they have run */
+	server->xwayland.flushIdle = NULL;
+	XWaylandFlushConfigures(server);
+}
+
+/* Return true if an output is going to render a frame soon */
+static bool XWaylandFramesDue(mwdServer *server)
+{
+	mwdOutput			*output;
+
+	wl_list_for_each(output, &server->outputs, link) {
+		if (output->powered && !output->idle.throttled && VirtualIsConsumed(output)) {
+			return true;
+		}
+	}
+	return false;
+}
+
 static void XWaylandSetPos(mwdView *view, double top, double right, double bottom, double left)
 {
 	if (!XWaylandIsValid(view)) {
@@ -60,7 +228,59 @@ static void XWaylandSetPos(mwdView *view, double top, double right, double botto
 	view->bottom	= bottom;
 	view->left		= left;
 
-    wlr_xwayland_surface_configure(view->xwayland.surface, view->left, view->top, right - left, bottom - top);
+	/*
+		Don't send the configure yet. A grab can move the view many times for
+		each batch of input events, and each configure is a ConfigureNotify the
+		client has to process, so only the latest position is sent, before the
+		next frame.
+
+		There may never be a frame while every output is off or throttled, and
+		the layout transactions wait on X11 views to commit, so in that case
+		the configure is sent once the event loop is idle instead.
+	*/
+	if (!view->xwayland.configurePending) {
+		view->xwayland.configurePending = true;
+		wl_list_insert(&view->server->xwayland.pending, &view->xwayland.pendingLink);
+	}
+
+	if (!XWaylandFramesDue(view->server)) {
+		if (!view->server->xwayland.flushIdle) {
+			view->server->xwayland.flushIdle = wl_event_loop_add_idle(
+					wl_display_get_event_loop(view->server->display), XWaylandFlushIdle, view->server);
+		}
+	}
+}
+
+/*
+	Use the ICCCM size hints as constraints, so that a resize doesn't ask for
+	sizes the client is going to clamp anyway. wlroots sets the hints that
+	weren't provided to -1.
+*/
+static bool XWaylandGetConstraints(mwdView *view, double *minWidth, double *maxWidth, double *minHeight, double *maxHeight)
+{
+	struct wlr_xwayland_surface_size_hints	*hints;
+
+	if (!XWaylandIsValid(view) || !(hints = view->xwayland.surface->size_hints)) {
+		return false;
+	}
+
+	if (minWidth) {
+		*minWidth	= hints->min_width > 0 ? hints->min_width : 0;
+	}
+
+	if (maxWidth) {
+		*maxWidth	= hints->max_width > 0 ? hints->max_width : 0;
+	}
+
+	if (minHeight) {
+		*minHeight	= hints->min_height > 0 ? hints->min_height : 0;
+	}
+
+	if (maxHeight) {
+		*maxHeight	= hints->max_height > 0 ? hints->max_height : 0;
+	}
+
+	return true;
 }
 
 
@@ -122,6 +342,50 @@ static bool XWaylandIsVisible(mwdView *view, mwdOutput *output)
 	return true;
 }
 
+static bool XWaylandIsFloating(mwdView *view)
+{
+	struct wlr_xwayland_surface				*surface;
+	struct wlr_xwayland_surface_size_hints	*hints;
+
+	if (!XWaylandIsValid(view)) {
+		return false;
+	}
+	surface = view->xwayland.surface;
+
+	/* Menus, tooltips, dialogs, etc */
+	if (surface->override_redirect || surface->modal || surface->parent) {
+		return true;
+	}
+
+	/* Views that can't be resized */
+	if ((hints = surface->size_hints) &&
+		hints->min_width > 0 && hints->min_height > 0 &&
+		hints->min_width == hints->max_width && hints->min_height == hints->max_height
+	) {
+		return true;
+	}
+	return false;
+}
+
+static bool XWaylandIsConfigured(mwdView *view)
+{
+	if (!XWaylandIsValid(view)) {
+		return true;
+	}
+
+	return !view->xwayland.awaitingCommit && !view->xwayland.configurePending;
+}
+
+static void XWaylandCommit(mwdView *view)
+{
+	if (!XWaylandIsValid(view)) {
+		return;
+	}
+
+	view->xwayland.awaitingCommit = false;
+	XWaylandFirstWindow(view->server, view->xwayland.surface);
+}
+
 static bool XWaylandIsAt(mwdView *view, double x, double y, struct wlr_surface **psurface, double *offsetX, double *offsetY)
 {
 	struct wlr_surface		*surface;
@@ -181,23 +445,169 @@ mwdViewInterface XWaylandViewInterface = {
 	.get = {
 		.pos			= &XWaylandGetPos,
 		.surface		= &XWaylandGetSurface,
-		.constraints	= NULL,
+		.appId			= &XWaylandGetAppId,
+		.title			= &XWaylandGetTitle,
+		.constraints	= &XWaylandGetConstraints,
 	},
 
 	.is = {
 		.valid			= &XWaylandIsValid,
 		.visible		= &XWaylandIsVisible,
 		.at				= &XWaylandIsAt,
+		.floating		= &XWaylandIsFloating,
+		.configured		= &XWaylandIsConfigured,
 	},
 
 	.foreach = {
 		.surface		= &XWaylandEachSurface
 	},
 
+	.commit				= &XWaylandCommit,
+	.flush				= &XWaylandFlush,
 	.destroy			= &XWaylandDestroyView,
 	.render				= &XWaylandRenderView
 };
 
+/*
+	Override-redirect surfaces
+
+	These are kept out of the store and the view lists entirely, so they are
+	never tiled, focused or given tags, and the only work done for them is to
+	render them above the views and to check them first when hit-testing.
+*/
+static void XWaylandUnmanagedMap(struct wl_listener *listener, void *data)
+{
+	mwdXWaylandUnmanaged		*unmanaged	= wl_container_of(listener, unmanaged, map);
+
+	wl_list_insert(&unmanaged->server->xwayland.unmanaged, &unmanaged->link);
+	XWaylandFirstWindow(unmanaged->server, unmanaged->surface);
+}
+
+static void XWaylandUnmanagedUnmap(struct wl_listener *listener, void *data)
+{
+	mwdXWaylandUnmanaged		*unmanaged	= wl_container_of(listener, unmanaged, unmap);
+
+	wl_list_remove(&unmanaged->link);
+	wl_list_init(&unmanaged->link);
+}
+
+static void XWaylandUnmanagedDestroy(struct wl_listener *listener, void *data)
+{
+	mwdXWaylandUnmanaged		*unmanaged	= wl_container_of(listener, unmanaged, destroy);
+
+	wl_list_remove(&unmanaged->link);
+	wl_list_remove(&unmanaged->map.link);
+	wl_list_remove(&unmanaged->unmap.link);
+	wl_list_remove(&unmanaged->destroy.link);
+	wl_list_remove(&unmanaged->requestConfigure.link);
+
+	XWaylandSurfaceRemoved(unmanaged->server);
+	free(unmanaged);
+}
+
+/* The surface places itself, so give it what it asked for */
+static void XWaylandUnmanagedRequestConfigure(struct wl_listener *listener, void *data)
+{
+	mwdXWaylandUnmanaged		*unmanaged	= wl_container_of(listener, unmanaged, requestConfigure);
+	struct wlr_xwayland_surface_configure_event	*event = data;
+
+	wlr_xwayland_surface_configure(unmanaged->surface, event->x, event->y, event->width, event->height);
+}
+
+static void XWaylandUnmanagedAdd(mwdServer *server, struct wlr_xwayland_surface *surface)
+{
+	mwdXWaylandUnmanaged		*unmanaged;
+
+	if (!(unmanaged = calloc(1, sizeof(mwdXWaylandUnmanaged)))) {
+		wlr_log(WLR_ERROR, "Failed to allocate an override-redirect surface");
+		return;
+	}
+	unmanaged->server	= server;
+	unmanaged->surface	= surface;
+	wl_list_init(&unmanaged->link);
+
+	XWaylandSurfaceAdded(server);
+
+	unmanaged->map.notify				= XWaylandUnmanagedMap;
+	unmanaged->unmap.notify				= XWaylandUnmanagedUnmap;
+	unmanaged->destroy.notify			= XWaylandUnmanagedDestroy;
+	unmanaged->requestConfigure.notify	= XWaylandUnmanagedRequestConfigure;
+
+	wl_signal_add(&surface->events.map,					&unmanaged->map);
+	wl_signal_add(&surface->events.unmap,				&unmanaged->unmap);
+	wl_signal_add(&surface->events.destroy,				&unmanaged->destroy);
+	wl_signal_add(&surface->events.request_configure,	&unmanaged->requestConfigure);
+}
+
+/* Render the override-redirect surfaces that overlap the output, oldest first */
+void XWaylandRenderUnmanaged(mwdOutput *output, struct wlr_renderer *renderer)
+{
+	mwdServer					*server		= output->server;
+	mwdXWaylandUnmanaged		*unmanaged;
+	struct wlr_xwayland_surface	*surface;
+	struct wlr_box				box;
+	mwdRenderData				rdata;
+	double						ox			= 0;
+	double						oy			= 0;
+
+	if (wl_list_empty(&server->xwayland.unmanaged)) {
+		return;
+	}
+
+	memset(&rdata, 0, sizeof(rdata));
+
+	rdata.output		= output->output;
+	rdata.renderer		= renderer;
+
+	clock_gettime(CLOCK_MONOTONIC, &rdata.when);
+	wlr_output_layout_output_coords(server->layout, output->output, &ox, &oy);
+
+	wl_list_for_each_reverse(unmanaged, &server->xwayland.unmanaged, link) {
+		surface = unmanaged->surface;
+
+		box.x		= surface->x;
+		box.y		= surface->y;
+		box.width	= surface->width;
+		box.height	= surface->height;
+
+		if (!surface->surface || !wlr_output_layout_intersects(server->layout, output->output, &box)) {
+			continue;
+		}
+
+		rdata.sx	= surface->x + ox;
+		rdata.sy	= surface->y + oy;
+
+		wlr_surface_for_each_surface(surface->surface, RenderSurface, &rdata);
+	}
+}
+
+/* Find the top most override-redirect surface at a point in layout coordinates */
+struct wlr_surface *XWaylandUnmanagedAt(mwdServer *server, double x, double y, double *offsetX, double *offsetY)
+{
+	mwdXWaylandUnmanaged		*unmanaged;
+	struct wlr_surface			*surface;
+	double						offX, offY;
+
+	wl_list_for_each(unmanaged, &server->xwayland.unmanaged, link) {
+		if (!unmanaged->surface->surface) {
+			continue;
+		}
+
+		if ((surface = wlr_surface_surface_at(unmanaged->surface->surface,
+				x - unmanaged->surface->x, y - unmanaged->surface->y, &offX, &offY))
+		) {
+			if (offsetX) {
+				*offsetX = offX;
+			}
+			if (offsetY) {
+				*offsetY = offY;
+			}
+			return surface;
+		}
+	}
+	return NULL;
+}
+
 /* Received a new xwayland surface from a client.  */
 static void XWaylandNewSurface(struct wl_listener *listener, void *data)
 {
@@ -205,6 +615,11 @@ static void XWaylandNewSurface(struct wl_listener *listener, void *data)
 	mwdView						*view;
 	struct wlr_xwayland_surface	*surface		= data;
 
+	if (surface->override_redirect) {
+		XWaylandUnmanagedAdd(server, surface);
+		return;
+	}
+
 	/* Allocate our own view structure for this surface */
 	if (!(view = CreateNewView(server))) {
 		return;
@@ -212,11 +627,16 @@ static void XWaylandNewSurface(struct wl_listener *listener, void *data)
 	view->type				= MWD_XWAYLAND_SHELL;
 	view->xwayland.surface	= surface;
 	view->cb				= &XWaylandViewInterface;
+	wl_list_init(&view->xwayland.pendingLink);
+
+	XWaylandSurfaceAdded(server);
 
 	/* Listen to the various events it can emit */
 	wl_signal_add(&surface->events.map,						&view->map);
 	wl_signal_add(&surface->events.unmap,					&view->unmap);
 	wl_signal_add(&surface->events.destroy,					&view->destroy);
+	wl_signal_add(&surface->events.set_title,				&view->rules.setTitle);
+	wl_signal_add(&surface->events.set_class,				&view->rules.setAppId);
 
 	/* Add it to the list of views */
 	wl_list_insert(&server->views.drawOrder, &view->link.drawOrder);
@@ -227,6 +647,8 @@ static void XWaylandNewSurface(struct wl_listener *listener, void *data)
 
 	view->right		= view->left + surface->width;
 	view->bottom	= view->top + surface->height;
+
+	RulesEvaluate(view);
 }
 
 static void XWaylandReady(struct wl_listener *listener, void *data)
@@ -234,25 +656,229 @@ static void XWaylandReady(struct wl_listener *listener, void *data)
 	mwdServer					*server			= wl_container_of(listener, server, xwayland.ready);
 
     wlr_xwayland_set_seat(server->xwayland.shell, server->seat);
-}
 
-// TODO view->xwayland.surface->size_hints can be used for constraints
-// TODO There are many other events to listen to for xwayland
+	if (server->xwayland.prewarmFd >= 0) {
+		/* The connection that started it isn't needed anymore */
+		close(server->xwayland.prewarmFd);
+		server->xwayland.prewarmFd = -1;
+	}
 
-void XWaylandMain(mwdServer *server)
+	/* Nothing may ever connect to a prewarmed Xwayland */
+	if (!server->xwayland.surfaces && server->xwayland.idleTimer) {
+		wl_event_source_timer_update(server->xwayland.idleTimer, server->xwayland.idleSecs * 1000);
+	}
+}
+
+static bool XWaylandCreate(mwdServer *server)
 {
+	server->xwayland.warm		= false;
+	server->xwayland.measured	= false;
+	server->xwayland.prewarmFd	= -1;
+
 	if (!(server->xwayland.shell = wlr_xwayland_create(server->display, server->compositor, TRUE))) {
 		wlr_log(WLR_ERROR, "Failed to start Xwayland");
 		unsetenv("DISPLAY");
-	} else {
-		server->xwayland.newSurface.notify = XWaylandNewSurface;
-		wl_signal_add(&server->xwayland.shell->events.new_surface, &server->xwayland.newSurface);
+		return false;
+	}
+
+	server->xwayland.newSurface.notify = XWaylandNewSurface;
+	wl_signal_add(&server->xwayland.shell->events.new_surface, &server->xwayland.newSurface);
+
+	server->xwayland.ready.notify = XWaylandReady;
+	wl_signal_add(&server->xwayland.shell->events.ready, &server->xwayland.ready);
+
+	setenv("DISPLAY", server->xwayland.shell->display_name, true);
+	return true;
+}
+
+static void XWaylandDestroy(mwdServer *server)
+{
+	if (!server->xwayland.shell) {
+		return;
+	}
+
+	wl_list_remove(&server->xwayland.newSurface.link);
+	wl_list_remove(&server->xwayland.ready.link);
 
-		server->xwayland.ready.notify = XWaylandReady;
-		wl_signal_add(&server->xwayland.shell->events.ready, &server->xwayland.ready);
+	wlr_xwayland_destroy(server->xwayland.shell);
+	server->xwayland.shell = NULL;
 
-		setenv("DISPLAY", server->xwayland.shell->display_name, true);
+	if (server->xwayland.prewarmFd >= 0) {
+		close(server->xwayland.prewarmFd);
+		server->xwayland.prewarmFd = -1;
 	}
 }
 
+/*
+	Xwayland is started lazily, when the first client connects to its socket,
+	so connecting to it is enough to start it. The connection is held open
+	until Xwayland is ready.
+*/
+static void XWaylandPrewarm(void *data)
+{
+	mwdServer				*server		= data;
+	struct sockaddr_un		addr		= { .sun_family = AF_UNIX };
+	int						fd;
+
+	if (!server->xwayland.shell || server->xwayland.surfaces || server->xwayland.shell->xwm) {
+		/* Already running */
+		return;
+	}
+
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/.X11-unix/X%d", server->xwayland.shell->server->display);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		return;
+	}
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+		wlr_log_errno(WLR_ERROR, "Failed to start Xwayland early");
+		close(fd);
+		return;
+	}
+
+	wlr_log(WLR_INFO, "Starting Xwayland before it is needed");
+	server->xwayland.prewarmFd	= fd;
+	server->xwayland.warm		= true;
+}
+
+/* Wait until there is nothing else to do before starting Xwayland */
+static int XWaylandPrewarmTimer(void *data)
+{
+	mwdServer				*server	= data;
+
+	wl_event_loop_add_idle(wl_display_get_event_loop(server->display), XWaylandPrewarm, server);
+	return 0;
+}
+
+/*
+	There have been no X windows for a while. Stop Xwayland, and go back to
+	starting it lazily when the next X client connects.
+
+	Only the Xwayland process is stopped. wlroots keeps listening on the same
+	sockets and starts it again lazily, so the DISPLAY that running clients
+	were given stays valid. wlroots only does that for a process that ran for
+	more than 5 seconds though, so a younger one is left alone for now.
+*/
+#define XWAYLAND_RESTART_SECS			5
+
+static int XWaylandIdleTimer(void *data)
+{
+	mwdServer					*server	= data;
+	struct wlr_xwayland_server	*xserver;
+
+	if (server->xwayland.surfaces || !server->xwayland.shell) {
+		return 0;
+	}
+
+	if (!(xserver = server->xwayland.shell->server) || !xserver->client) {
+		/* Not running */
+		return 0;
+	}
+
+	if (time(NULL) - xserver->server_start <= XWAYLAND_RESTART_SECS) {
+		wl_event_source_timer_update(server->xwayland.idleTimer, (XWAYLAND_RESTART_SECS + 1) * 1000);
+		return 0;
+	}
+
+	wlr_log(WLR_INFO, "Stopping Xwayland after %d seconds with no X windows", server->xwayland.idleSecs);
+
+	if (server->xwayland.prewarmFd >= 0) {
+		close(server->xwayland.prewarmFd);
+		server->xwayland.prewarmFd = -1;
+	}
+
+	/* The next instance is started lazily, and gets its own first window */
+	server->xwayland.warm		= false;
+	server->xwayland.measured	= false;
+
+	wl_client_destroy(xserver->client);
+	return 0;
+}
+
+/*
+	Set the Xwayland startup policy:
+		lazy					Start Xwayland when the first X client connects
+		prewarm[:seconds]		Start Xwayland shortly after startup, and stop
+								it after the specified number of seconds with
+								no X windows (or never if not specified)
+*/
+bool XWaylandSetPolicy(mwdServer *server, const char *policy)
+{
+	char					*end;
+
+	if (!strcmp(policy, "lazy")) {
+		server->xwayland.prewarm	= false;
+		server->xwayland.idleSecs	= 0;
+		return true;
+	}
+
+	if (strncmp(policy, "prewarm", 7)) {
+		goto failure;
+	}
+	server->xwayland.prewarm	= true;
+	server->xwayland.idleSecs	= 0;
+
+	if (policy[7] == ':') {
+		server->xwayland.idleSecs = strtol(policy + 8, &end, 10);
+
+		if (end == policy + 8 || *end || server->xwayland.idleSecs < 0) {
+			goto failure;
+		}
+	} else if (policy[7]) {
+		goto failure;
+	}
+	return true;
+
+failure:
+	wlr_log(WLR_ERROR, "Invalid Xwayland policy: %s", policy);
+	return false;
+}
+
+// TODO There are many other events to listen to for xwayland
+
+#define XWAYLAND_PREWARM_DELAY_MS		2000
+
+void XWaylandMain(mwdServer *server)
+{
+	struct wl_event_loop	*loop = wl_display_get_event_loop(server->display);
+
+	wl_list_init(&server->xwayland.pending);
+	wl_list_init(&server->xwayland.unmanaged);
+
+	HistogramInit(&server->xwayland.coldHist, "xwayland first window (cold)");
+	HistogramInit(&server->xwayland.warmHist, "xwayland first window (warm)");
+
+	if (!XWaylandCreate(server)) {
+		return;
+	}
+
+	if (server->xwayland.prewarm) {
+		server->xwayland.prewarmTimer = wl_event_loop_add_timer(loop, XWaylandPrewarmTimer, server);
+		wl_event_source_timer_update(server->xwayland.prewarmTimer, XWAYLAND_PREWARM_DELAY_MS);
+
+		if (server->xwayland.idleSecs) {
+			server->xwayland.idleTimer = wl_event_loop_add_timer(loop, XWaylandIdleTimer, server);
+		}
+	}
+}
+
+void XWaylandStop(mwdServer *server)
+{
+	if (server->xwayland.flushIdle) {
+		wl_event_source_remove(server->xwayland.flushIdle);
+		server->xwayland.flushIdle = NULL;
+	}
+	if (server->xwayland.prewarmTimer) {
+		wl_event_source_remove(server->xwayland.prewarmTimer);
+		server->xwayland.prewarmTimer = NULL;
+	}
+	if (server->xwayland.idleTimer) {
+		wl_event_source_remove(server->xwayland.idleTimer);
+		server->xwayland.idleTimer = NULL;
+	}
+
+	XWaylandDestroy(server);
+}
+
 